@@ -8,13 +8,2700 @@
 #include <algorithm>
 #include <cstdlib>
 #include <cmath>
+#include <cstdint>
+#include <mutex>
+#include <atomic>
+#include <cstring>
+#include <climits>
+#include <thread>
+#include <deque>
+#include <fstream>
+#include <unordered_map>
+#include <iomanip>
+#include <functional>
+#include <map>
+#include <memory>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cerrno>
+#include <csignal>
+#endif
+
+#if defined(__BMI2__) || defined(__AVX2__) || defined(__SSE4_1__)
+#include <immintrin.h>
+#endif
+
+#if defined(__BMI2__)
+#define USE_PEXT
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// -------------------------
+// Bitboards
+// -------------------------
+// Squares are numbered row * 8 + col, so a1 = 0, h1 = 7 and h8 = 63.
+// Bit n of a bitboard is set when square n is part of the set.
+typedef uint64_t Bitboard;
+
+const Bitboard FILE_A_BB = 0x0101010101010101ULL;
+const Bitboard FILE_H_BB = FILE_A_BB << 7;
+const Bitboard RANK_1_BB = 0xFFULL;
+const Bitboard RANK_2_BB = RANK_1_BB << 8;
+const Bitboard RANK_7_BB = RANK_1_BB << 48;
+const Bitboard RANK_8_BB = RANK_1_BB << 56;
+
+inline Bitboard squareBB(int sq) {
+    return 1ULL << sq;
+}
+
+inline int popCount(Bitboard b) {
+#if defined(_MSC_VER)
+    return int(__popcnt64(b));
+#else
+    return __builtin_popcountll(b);
+#endif
+}
+
+// Index of the least significant set bit; b must be non-zero
+inline int lsb(Bitboard b) {
+#if defined(_MSC_VER)
+    unsigned long idx;
+    _BitScanForward64(&idx, b);
+    return int(idx);
+#else
+    return __builtin_ctzll(b);
+#endif
+}
+
+// Index of the most significant set bit; b must be non-zero
+inline int msb(Bitboard b) {
+#if defined(_MSC_VER)
+    unsigned long idx;
+    _BitScanReverse64(&idx, b);
+    return int(idx);
+#else
+    return 63 ^ __builtin_clzll(b);
+#endif
+}
+
+// Removes the least significant set bit from b and returns its index
+inline int popLsb(Bitboard& b) {
+    int sq = lsb(b);
+    b &= b - 1;
+    return sq;
+}
+
+// Precomputed attack tables for the leaper pieces. Pawn attacks are indexed
+// by color first (0 = white, 1 = black).
+Bitboard knightAttackTable[64];
+Bitboard kingAttackTable[64];
+Bitboard pawnAttackTable[2][64];
+
+// Squares strictly between two squares on a common rank, file or diagonal, and
+// the whole line through them; both are empty for unaligned squares. Used for
+// check evasions (block or capture) and for moves of pinned pieces.
+Bitboard betweenBB[64][64];
+Bitboard lineBB[64][64];
+
+// Sliding piece attacks are looked up through "fancy" magic bitboards: the
+// relevant blockers of a square are hashed into a per-square slice of a shared
+// table. With BMI2 the hash is replaced by PEXT, which is a perfect index.
+struct Magic {
+    Bitboard mask;
+    Bitboard magic;
+    Bitboard* attacks;
+    unsigned shift;
+    
+    unsigned index(Bitboard occupied) const {
+#if defined(USE_PEXT)
+        return unsigned(_pext_u64(occupied, mask));
+#else
+        return unsigned(((occupied & mask) * magic) >> shift);
+#endif
+    }
+};
+
+Magic rookMagics[64];
+Magic bishopMagics[64];
+Bitboard rookAttackTable[0x19000];
+Bitboard bishopAttackTable[0x1480];
+
+inline Bitboard bishopAttacks(int sq, Bitboard occupied) {
+    const Magic& m = bishopMagics[sq];
+    return m.attacks[m.index(occupied)];
+}
+
+inline Bitboard rookAttacks(int sq, Bitboard occupied) {
+    const Magic& m = rookMagics[sq];
+    return m.attacks[m.index(occupied)];
+}
+
+// Walks the rays from sq in the given directions, stopping at (and including)
+// the first occupied square. Only used to fill the tables at startup.
+Bitboard slidingAttacks(int sq, Bitboard occupied, const int directions[4][2]) {
+    Bitboard attacks = 0;
+    
+    for (int i = 0; i < 4; i++) {
+        int row = sq / 8 + directions[i][0];
+        int col = sq % 8 + directions[i][1];
+        
+        while (row >= 0 && row < 8 && col >= 0 && col < 8) {
+            attacks |= squareBB(row * 8 + col);
+            if (occupied & squareBB(row * 8 + col)) {
+                break;
+            }
+            row += directions[i][0];
+            col += directions[i][1];
+        }
+    }
+    return attacks;
+}
+
+// xorshift64* generator used for magic numbers and Zobrist keys. It is always
+// run from fixed seeds, so both are the same on every run.
+class PRNG {
+    uint64_t s;
+    
+public:
+    explicit PRNG(uint64_t seed) : s(seed) {}
+    
+    uint64_t next() {
+        s ^= s >> 12;
+        s ^= s << 25;
+        s ^= s >> 27;
+        return s * 2685821657736338717ULL;
+    }
+    
+    // Candidates with few set bits make better magics
+    uint64_t sparse() {
+        return next() & next() & next();
+    }
+};
+
+void initMagics(Bitboard table[], Magic magics[], const int directions[4][2]) {
+    std::vector<Bitboard> occupancy(4096), reference(4096);
+    int size = 0;
+
+#if !defined(USE_PEXT)
+    const uint64_t seeds[8] = { 728, 10316, 55013, 32803, 12281, 15100, 16645, 255 };
+    std::vector<int> epoch(4096, 0);
+    int attempt = 0;
+#endif
+    
+    for (int sq = 0; sq < 64; sq++) {
+        Magic& m = magics[sq];
+        
+        // Board edges are not relevant blockers unless the piece stands on them
+        Bitboard edges = ((RANK_1_BB | RANK_8_BB) & ~(RANK_1_BB << (8 * (sq / 8))))
+                       | ((FILE_A_BB | FILE_H_BB) & ~(FILE_A_BB << (sq % 8)));
+        
+        m.mask = slidingAttacks(sq, 0, directions) & ~edges;
+        m.shift = 64 - popCount(m.mask);
+        m.attacks = (sq == 0) ? table : magics[sq - 1].attacks + size;
+        
+        // Enumerate every subset of the mask (Carry-Rippler trick)
+        Bitboard b = 0;
+        size = 0;
+        do {
+            occupancy[size] = b;
+            reference[size] = slidingAttacks(sq, b, directions);
+#if defined(USE_PEXT)
+            m.attacks[m.index(b)] = reference[size];
+#endif
+            size++;
+            b = (b - m.mask) & m.mask;
+        } while (b);
+
+#if !defined(USE_PEXT)
+        // Seeded per rank with values known to find all magics quickly
+        PRNG rng(seeds[sq / 8]);
+        
+        // Try candidates until one maps every subset without a destructive collision
+        for (int i = 0; i < size; ) {
+            for (m.magic = 0; popCount((m.magic * m.mask) >> 56) < 6; ) {
+                m.magic = rng.sparse();
+            }
+            
+            for (++attempt, i = 0; i < size; i++) {
+                unsigned idx = m.index(occupancy[i]);
+                
+                if (epoch[idx] < attempt) {
+                    epoch[idx] = attempt;
+                    m.attacks[idx] = reference[i];
+                } else if (m.attacks[idx] != reference[i]) {
+                    break;
+                }
+            }
+        }
+#endif
+    }
+}
+
+void initAttackTables() {
+    static std::once_flag initialized;
+    
+    std::call_once(initialized, [] {
+        const int knightSteps[8][2] = {
+            {-2, -1}, {-2, 1}, {-1, -2}, {-1, 2},
+            {1, -2},  {1, 2},  {2, -1},  {2, 1}
+        };
+        const int kingSteps[8][2] = {
+            {-1, -1}, {-1, 0}, {-1, 1}, {0, -1},
+            {0, 1}, {1, -1}, {1, 0}, {1, 1}
+        };
+        const int bishopDirections[4][2] = {
+            {-1, -1}, {-1, 1}, {1, -1}, {1, 1}
+        };
+        const int rookDirections[4][2] = {
+            {-1, 0}, {1, 0}, {0, -1}, {0, 1}
+        };
+        
+        for (int sq = 0; sq < 64; sq++) {
+            int row = sq / 8;
+            int col = sq % 8;
+            
+            knightAttackTable[sq] = 0;
+            kingAttackTable[sq] = 0;
+            
+            for (int i = 0; i < 8; i++) {
+                int r = row + knightSteps[i][0];
+                int c = col + knightSteps[i][1];
+                if (r >= 0 && r < 8 && c >= 0 && c < 8) {
+                    knightAttackTable[sq] |= squareBB(r * 8 + c);
+                }
+                
+                r = row + kingSteps[i][0];
+                c = col + kingSteps[i][1];
+                if (r >= 0 && r < 8 && c >= 0 && c < 8) {
+                    kingAttackTable[sq] |= squareBB(r * 8 + c);
+                }
+            }
+            
+            Bitboard b = squareBB(sq);
+            pawnAttackTable[0][sq] = ((b & ~FILE_A_BB) << 7) | ((b & ~FILE_H_BB) << 9);
+            pawnAttackTable[1][sq] = ((b & ~FILE_A_BB) >> 9) | ((b & ~FILE_H_BB) >> 7);
+        }
+        
+        initMagics(rookAttackTable, rookMagics, rookDirections);
+        initMagics(bishopAttackTable, bishopMagics, bishopDirections);
+        
+        for (int s1 = 0; s1 < 64; s1++) {
+            for (int s2 = 0; s2 < 64; s2++) {
+                betweenBB[s1][s2] = lineBB[s1][s2] = 0;
+                
+                if (rookAttacks(s1, 0) & squareBB(s2)) {
+                    betweenBB[s1][s2] = rookAttacks(s1, squareBB(s2)) & rookAttacks(s2, squareBB(s1));
+                    lineBB[s1][s2] = (rookAttacks(s1, 0) & rookAttacks(s2, 0)) | squareBB(s1) | squareBB(s2);
+                } else if (bishopAttacks(s1, 0) & squareBB(s2)) {
+                    betweenBB[s1][s2] = bishopAttacks(s1, squareBB(s2)) & bishopAttacks(s2, squareBB(s1));
+                    lineBB[s1][s2] = (bishopAttacks(s1, 0) & bishopAttacks(s2, 0)) | squareBB(s1) | squareBB(s2);
+                }
+            }
+        }
+    });
+}
+
+// -------------------------
+// Zobrist hashing
+// -------------------------
+// A position's key is the XOR of one random number per (piece, square) pair
+// plus numbers for the side to move, the castling flags and the en passant
+// file, so makeMove can update it with a handful of XORs.
+uint64_t zobristPieces[13][64];
+uint64_t zobristCastling[64];  // Indexed by the packed castling flags
+uint64_t zobristEnPassant[8];
+uint64_t zobristBlackToMove;
+
+void initZobristKeys() {
+    static std::once_flag initialized;
+    
+    std::call_once(initialized, [] {
+        PRNG rng(1070372);
+        
+        for (int piece = 0; piece < 13; piece++) {
+            for (int sq = 0; sq < 64; sq++) {
+                zobristPieces[piece][sq] = (piece == 0) ? 0 : rng.next();
+            }
+        }
+        for (int flags = 0; flags < 64; flags++) {
+            zobristCastling[flags] = rng.next();
+        }
+        for (int col = 0; col < 8; col++) {
+            zobristEnPassant[col] = rng.next();
+        }
+        zobristBlackToMove = rng.next();
+    });
+}
+
+// -------------------------
+// Evaluation tables
+// -------------------------
+// Material and piece-square values for the middlegame and the endgame. The
+// evaluation blends the two by game phase, which counts the remaining minor
+// and major pieces (knight/bishop 1, rook 2, queen 4; 24 at the start).
+const int PHASE_WEIGHT[7] = { 0, 0, 1, 1, 2, 4, 0 };
+const int MAX_PHASE = 24;
+
+// The weights up to the #endif can be replaced by a header written by
+// "nexa --tune" (see runTune), which defines the same constants: build with
+// -DEVAL_WEIGHTS='"weights.h"'.
+#if defined(EVAL_WEIGHTS)
+#include EVAL_WEIGHTS
+#else
+const int MATERIAL_MG[7] = { 0, 100, 320, 330, 500, 900, 20000 };
+const int MATERIAL_EG[7] = { 0, 100, 320, 330, 500, 900, 20000 };
+
+// Piece-square tables from white's point of view, laid out as the board is
+// drawn: the first row is rank 8, the last is rank 1.
+const int PAWN_MG[64] = {
+     0,  0,  0,  0,  0,  0,  0,  0,
+    50, 50, 50, 50, 50, 50, 50, 50,
+    10, 10, 20, 30, 30, 20, 10, 10,
+     5,  5, 10, 25, 25, 10,  5,  5,
+     0,  0,  0, 20, 20,  0,  0,  0,
+     5, -5,-10,  0,  0,-10, -5,  5,
+     5, 10, 10,-20,-20, 10, 10,  5,
+     0,  0,  0,  0,  0,  0,  0,  0
+};
+
+const int PAWN_EG[64] = {
+     0,  0,  0,  0,  0,  0,  0,  0,
+    80, 80, 80, 80, 80, 80, 80, 80,
+    50, 50, 50, 50, 50, 50, 50, 50,
+    30, 30, 30, 30, 30, 30, 30, 30,
+    15, 15, 15, 15, 15, 15, 15, 15,
+     5,  5,  5,  5,  5,  5,  5,  5,
+     0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0
+};
+
+const int KNIGHT_PST[64] = {
+   -50,-40,-30,-30,-30,-30,-40,-50,
+   -40,-20,  0,  0,  0,  0,-20,-40,
+   -30,  0, 10, 15, 15, 10,  0,-30,
+   -30,  5, 15, 20, 20, 15,  5,-30,
+   -30,  0, 15, 20, 20, 15,  0,-30,
+   -30,  5, 10, 15, 15, 10,  5,-30,
+   -40,-20,  0,  5,  5,  0,-20,-40,
+   -50,-40,-30,-30,-30,-30,-40,-50
+};
+
+const int BISHOP_PST[64] = {
+   -20,-10,-10,-10,-10,-10,-10,-20,
+   -10,  0,  0,  0,  0,  0,  0,-10,
+   -10,  0,  5, 10, 10,  5,  0,-10,
+   -10,  5,  5, 10, 10,  5,  5,-10,
+   -10,  0, 10, 10, 10, 10,  0,-10,
+   -10, 10, 10, 10, 10, 10, 10,-10,
+   -10,  5,  0,  0,  0,  0,  5,-10,
+   -20,-10,-10,-10,-10,-10,-10,-20
+};
+
+const int ROOK_PST[64] = {
+     0,  0,  0,  0,  0,  0,  0,  0,
+     5, 10, 10, 10, 10, 10, 10,  5,
+    -5,  0,  0,  0,  0,  0,  0, -5,
+    -5,  0,  0,  0,  0,  0,  0, -5,
+    -5,  0,  0,  0,  0,  0,  0, -5,
+    -5,  0,  0,  0,  0,  0,  0, -5,
+    -5,  0,  0,  0,  0,  0,  0, -5,
+     0,  0,  0,  5,  5,  0,  0,  0
+};
+
+const int QUEEN_PST[64] = {
+   -20,-10,-10, -5, -5,-10,-10,-20,
+   -10,  0,  0,  0,  0,  0,  0,-10,
+   -10,  0,  5,  5,  5,  5,  0,-10,
+    -5,  0,  5,  5,  5,  5,  0, -5,
+     0,  0,  5,  5,  5,  5,  0, -5,
+   -10,  5,  5,  5,  5,  5,  0,-10,
+   -10,  0,  5,  0,  0,  0,  0,-10,
+   -20,-10,-10, -5, -5,-10,-10,-20
+};
+
+// The king hides behind its pawns in the middlegame and centralizes in the endgame
+const int KING_MG[64] = {
+   -30,-40,-40,-50,-50,-40,-40,-30,
+   -30,-40,-40,-50,-50,-40,-40,-30,
+   -30,-40,-40,-50,-50,-40,-40,-30,
+   -30,-40,-40,-50,-50,-40,-40,-30,
+   -20,-30,-30,-40,-40,-30,-30,-20,
+   -10,-20,-20,-20,-20,-20,-20,-10,
+    20, 20,  0,  0,  0,  0, 20, 20,
+    20, 30, 10,  0,  0, 10, 30, 20
+};
+
+const int KING_EG[64] = {
+   -50,-40,-30,-20,-20,-30,-40,-50,
+   -30,-20,-10,  0,  0,-10,-20,-30,
+   -30,-10, 20, 30, 30, 20,-10,-30,
+   -30,-10, 30, 40, 40, 30,-10,-30,
+   -30,-10, 30, 40, 40, 30,-10,-30,
+   -30,-10, 20, 30, 30, 20,-10,-30,
+   -30,-30,  0,  0,  0,  0,-30,-30,
+   -50,-30,-30,-30,-30,-30,-30,-50
+};
+
+// Pawn structure, indexed by the pawn's rank counted from its own side
+const int PASSED_PAWN_MG[8] = { 0, 5, 10, 15, 25, 40, 60, 0 };
+const int PASSED_PAWN_EG[8] = { 0, 10, 15, 25, 45, 70, 110, 0 };
+const int ISOLATED_PAWN_MG = -10;
+const int ISOLATED_PAWN_EG = -15;
+const int DOUBLED_PAWN_MG = -10;
+const int DOUBLED_PAWN_EG = -20;
+
+// King shelter (middlegame only), per file on and beside the king's file: an
+// own pawn one or two ranks in front of the king, or no own pawn in front at all
+const int SHELTER_PAWN_NEAR = 15;
+const int SHELTER_PAWN_FAR = 8;
+const int SHELTER_OPEN_FILE = -15;
+#endif
+
+const int* const PST_MG[7] = { nullptr, PAWN_MG, KNIGHT_PST, BISHOP_PST, ROOK_PST, QUEEN_PST, KING_MG };
+const int* const PST_EG[7] = { nullptr, PAWN_EG, KNIGHT_PST, BISHOP_PST, ROOK_PST, QUEEN_PST, KING_EG };
+
+// Material plus piece-square value of each piece code on each square, signed
+// from white's point of view, so the evaluation is a running sum of entries
+int pieceSquareMg[13][64];
+int pieceSquareEg[13][64];
+
+// Masks for the pawn structure terms. Color-indexed tables look towards the
+// opponent's side (up the board for white, down for black).
+Bitboard fileBB[8];
+Bitboard adjacentFilesBB[8];
+Bitboard forwardRanksBB[2][8];   // All ranks in front of a rank
+Bitboard forwardFileBB[2][64];   // Squares in front of a square on its file
+Bitboard passedPawnMaskBB[2][64];  // Squares enemy pawns must avoid for a pawn to be passed
+
+void initEvalTables() {
+    static std::once_flag initialized;
+    
+    std::call_once(initialized, [] {
+        for (int sq = 0; sq < 64; sq++) {
+            pieceSquareMg[0][sq] = pieceSquareEg[0][sq] = 0;
+            
+            for (int type = 1; type <= 6; type++) {
+                // The tables start at rank 8, so white reads them flipped and
+                // black (whose view is mirrored) reads them as they are
+                int whiteIndex = sq ^ 56;
+                int blackIndex = sq;
+                
+                pieceSquareMg[type][sq] = MATERIAL_MG[type] + PST_MG[type][whiteIndex];
+                pieceSquareEg[type][sq] = MATERIAL_EG[type] + PST_EG[type][whiteIndex];
+                pieceSquareMg[type + 6][sq] = -(MATERIAL_MG[type] + PST_MG[type][blackIndex]);
+                pieceSquareEg[type + 6][sq] = -(MATERIAL_EG[type] + PST_EG[type][blackIndex]);
+            }
+        }
+        
+        for (int col = 0; col < 8; col++) {
+            fileBB[col] = FILE_A_BB << col;
+        }
+        for (int col = 0; col < 8; col++) {
+            adjacentFilesBB[col] = (col > 0 ? fileBB[col - 1] : 0) | (col < 7 ? fileBB[col + 1] : 0);
+        }
+        for (int row = 0; row < 8; row++) {
+            forwardRanksBB[0][row] = (row < 7) ? ~Bitboard(0) << (8 * (row + 1)) : 0;
+            forwardRanksBB[1][row] = (row > 0) ? ~Bitboard(0) >> (8 * (8 - row)) : 0;
+        }
+        for (int color = 0; color < 2; color++) {
+            for (int sq = 0; sq < 64; sq++) {
+                Bitboard ahead = forwardRanksBB[color][sq / 8];
+                forwardFileBB[color][sq] = ahead & fileBB[sq % 8];
+                passedPawnMaskBB[color][sq] = ahead & (fileBB[sq % 8] | adjacentFilesBB[sq % 8]);
+            }
+        }
+    });
+}
+
+// Pawn structure and king shelter terms of one configuration of pawns and
+// kings, each counted for white minus black. The evaluation weighs the counts
+// with the constants above, and the tuner fits those constants to them.
+struct PawnTerms {
+    int passed[8];  // Passed pawns by rank, counted from their own side
+    int isolated;
+    int doubled;
+    int shelterNear;
+    int shelterFar;
+    int shelterOpen;
+};
+
+void countPawnTerms(const Bitboard pawnBB[2], const Bitboard kingBB[2], PawnTerms& terms) {
+    terms = PawnTerms{};
+    
+    for (int color = 0; color < 2; color++) {
+        int sign = (color == 0) ? 1 : -1;
+        Bitboard own = pawnBB[color];
+        Bitboard enemy = pawnBB[color ^ 1];
+        Bitboard pawns = own;
+        
+        while (pawns) {
+            int sq = popLsb(pawns);
+            int col = sq % 8;
+            int rank = (color == 0) ? sq / 8 : 7 - sq / 8;
+            
+            if (!(passedPawnMaskBB[color][sq] & enemy)) {
+                terms.passed[rank] += sign;
+            }
+            if (!(adjacentFilesBB[col] & own)) {
+                terms.isolated += sign;
+            }
+            // Only the rear pawn of a doubled pair is penalized
+            if (forwardFileBB[color][sq] & own) {
+                terms.doubled += sign;
+            }
+        }
+        
+        if (!kingBB[color]) {
+            continue;
+        }
+        int kingSq = lsb(kingBB[color]);
+        int kingCol = kingSq % 8;
+        for (int col = std::max(0, kingCol - 1); col <= std::min(7, kingCol + 1); col++) {
+            Bitboard shield = own & fileBB[col] & forwardRanksBB[color][kingSq / 8];
+            if (!shield) {
+                terms.shelterOpen += sign;
+                continue;
+            }
+            int nearest = (color == 0) ? lsb(shield) : msb(shield);
+            int distance = std::abs(nearest / 8 - kingSq / 8);
+            if (distance == 1) {
+                terms.shelterNear += sign;
+            } else if (distance == 2) {
+                terms.shelterFar += sign;
+            }
+        }
+    }
+}
+
+// Pawn hash entry: the pawn structure and king shelter score of one
+// configuration of pawns and kings
+struct PawnEntry {
+    uint64_t key;
+    int mg;
+    int eg;
+};
+
+const int PAWN_TABLE_SIZE = 16384;  // Entries per thread, a power of two
+
+// Evaluation cache entry: the full static evaluation of one position
+struct EvalCacheEntry {
+    uint64_t key;
+    int score;
+};
+
+const int EVAL_CACHE_SIZE = 8192;  // Entries per thread, a power of two
+
+// -------------------------
+// Memory-mapped files
+// -------------------------
+// A read-only view of a whole file. The pages are shared through the page
+// cache, so every engine process on the host that maps the same file uses a
+// single physical copy, and only the pages that are touched are ever read.
+class MappedFile {
+    const char* mapping = nullptr;
+    size_t mappingSize = 0;
+#if defined(_WIN32)
+    HANDLE fileHandle = INVALID_HANDLE_VALUE;
+    HANDLE mapHandle = nullptr;
+#endif
+
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    
+    ~MappedFile() {
+        close();
+    }
+    
+    // Maps the file, replacing any previous mapping. Returns false, with
+    // nothing mapped, when the file is missing or empty.
+    bool open(const std::string& path) {
+        close();
+
+#if defined(_WIN32)
+        HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                                  OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+        LARGE_INTEGER fileBytes;
+        GetFileSizeEx(file, &fileBytes);
+        size_t size = size_t(fileBytes.QuadPart);
+        HANDLE map = size ? CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr;
+        if (!map) {
+            CloseHandle(file);
+            return false;
+        }
+        const void* mem = MapViewOfFile(map, FILE_MAP_READ, 0, 0, 0);
+        if (!mem) {
+            CloseHandle(map);
+            CloseHandle(file);
+            return false;
+        }
+        fileHandle = file;
+        mapHandle = map;
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+            ::close(fd);
+            return false;
+        }
+        size_t size = size_t(st.st_size);
+        void* mem = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);  // The mapping stays valid after the descriptor is closed
+        if (mem == MAP_FAILED) {
+            return false;
+        }
+#endif
+        
+        mapping = static_cast<const char*>(mem);
+        mappingSize = size;
+        return true;
+    }
+    
+    void close() {
+        if (!mapping) {
+            return;
+        }
+#if defined(_WIN32)
+        UnmapViewOfFile(mapping);
+        CloseHandle(mapHandle);
+        CloseHandle(fileHandle);
+#else
+        munmap(const_cast<char*>(mapping), mappingSize);
+#endif
+        mapping = nullptr;
+        mappingSize = 0;
+    }
+    
+    void swap(MappedFile& other) {
+        std::swap(mapping, other.mapping);
+        std::swap(mappingSize, other.mappingSize);
+#if defined(_WIN32)
+        std::swap(fileHandle, other.fileHandle);
+        std::swap(mapHandle, other.mapHandle);
+#endif
+    }
+    
+    // Start of the mapping, nullptr when nothing is mapped
+    const char* data() const {
+        return mapping;
+    }
+    
+    size_t size() const {
+        return mappingSize;
+    }
+};
+
+// -------------------------
+// NNUE evaluation
+// -------------------------
+// An efficiently updatable neural network can replace evaluateBoard(). Its
+// input is a HalfKP feature set, seen once from each side's perspective: for
+// every non-king piece the triple (own king square, piece, square), with the
+// board flipped vertically for black so both sides see their king "below".
+//
+//   feature = kingSquare * 640 + pieceIndex * 64 + square
+//   pieceIndex = type - 1 for the perspective's own pieces, type + 4 for the enemy's
+//
+// The first layer (the feature transformer) turns the active features of one
+// perspective into NNUE_L1 int16 values: its bias plus one weight column per
+// feature. As a move changes at most four features, this "accumulator" is
+// updated incrementally along the search instead of being recomputed. The
+// side to move's accumulator and the opponent's are concatenated, clipped to
+// [0, 127] and fed through two int8 hidden layers and an output neuron.
+const int NNUE_FEATURES = 64 * 640;
+const int NNUE_L1 = 256;
+const int NNUE_L2 = 32;
+const int NNUE_L3 = 32;
+const int NNUE_WEIGHT_SHIFT = 6;   // Hidden layer outputs are scaled down by 2^6
+const int NNUE_OUTPUT_SCALE = 16;  // Network output units per centipawn
+
+// The network file is mapped into memory as is, so its layout is also the
+// in-memory layout. Every section is a multiple of 64 bytes long, which keeps
+// all of them cache-line (and SIMD) aligned relative to the mapping:
+//
+//   header        64 bytes: "NXNN", uint32 version, then the four layer
+//                 sizes above as uint32, zero padded
+//   ft biases     int16[NNUE_L1]
+//   ft weights    int16[NNUE_FEATURES][NNUE_L1]
+//   l1 biases     int32[NNUE_L2]
+//   l1 weights    int8[NNUE_L2][2 * NNUE_L1]
+//   l2 biases     int32[NNUE_L3]
+//   l2 weights    int8[NNUE_L3][NNUE_L2]
+//   out bias      int32, zero padded to 64 bytes
+//   out weights   int8[NNUE_L3], zero padded to 64 bytes
+//
+// All values are little endian.
+const uint32_t NNUE_MAGIC = 0x4E4E584E;  // "NXNN"
+const uint32_t NNUE_VERSION = 1;
+const size_t NNUE_HEADER_SIZE = 64;
+
+class NNUENetwork {
+    MappedFile mapping;
+    bool enabled = true;
+    
+    static size_t padded(size_t bytes) {
+        return (bytes + 63) / 64 * 64;
+    }
+    
+public:
+    // Views into the mapping, valid while a network is loaded
+    const int16_t* ftBiases = nullptr;
+    const int16_t* ftWeights = nullptr;
+    const int32_t* l1Biases = nullptr;
+    const int8_t* l1Weights = nullptr;
+    const int32_t* l2Biases = nullptr;
+    const int8_t* l2Weights = nullptr;
+    const int32_t* outBias = nullptr;
+    const int8_t* outWeights = nullptr;
+    
+    static size_t fileSize() {
+        return NNUE_HEADER_SIZE
+             + padded(NNUE_L1 * sizeof(int16_t))
+             + padded(size_t(NNUE_FEATURES) * NNUE_L1 * sizeof(int16_t))
+             + padded(NNUE_L2 * sizeof(int32_t))
+             + padded(NNUE_L2 * 2 * NNUE_L1)
+             + padded(NNUE_L3 * sizeof(int32_t))
+             + padded(NNUE_L3 * NNUE_L2)
+             + padded(sizeof(int32_t))
+             + padded(NNUE_L3);
+    }
+    
+    // Maps a network file read-only. Returns false (and keeps the previous
+    // network, if any) when the file is missing or malformed.
+    bool load(const std::string& path) {
+        MappedFile file;
+        if (!file.open(path)) {
+            return false;
+        }
+        
+        uint32_t header[6];
+        bool valid = file.size() == fileSize();
+        if (valid) {
+            std::memcpy(header, file.data(), sizeof(header));
+            valid = header[0] == NNUE_MAGIC && header[1] == NNUE_VERSION
+                 && header[2] == uint32_t(NNUE_FEATURES) && header[3] == uint32_t(NNUE_L1)
+                 && header[4] == uint32_t(NNUE_L2) && header[5] == uint32_t(NNUE_L3);
+        }
+        
+        if (!valid) {
+            return false;
+        }
+        
+        mapping.swap(file);  // The previous network, if any, is unmapped with file
+        
+        const char* p = mapping.data() + NNUE_HEADER_SIZE;
+        ftBiases = reinterpret_cast<const int16_t*>(p);
+        p += padded(NNUE_L1 * sizeof(int16_t));
+        ftWeights = reinterpret_cast<const int16_t*>(p);
+        p += padded(size_t(NNUE_FEATURES) * NNUE_L1 * sizeof(int16_t));
+        l1Biases = reinterpret_cast<const int32_t*>(p);
+        p += padded(NNUE_L2 * sizeof(int32_t));
+        l1Weights = reinterpret_cast<const int8_t*>(p);
+        p += padded(NNUE_L2 * 2 * NNUE_L1);
+        l2Biases = reinterpret_cast<const int32_t*>(p);
+        p += padded(NNUE_L3 * sizeof(int32_t));
+        l2Weights = reinterpret_cast<const int8_t*>(p);
+        p += padded(NNUE_L3 * NNUE_L2);
+        outBias = reinterpret_cast<const int32_t*>(p);
+        p += padded(sizeof(int32_t));
+        outWeights = reinterpret_cast<const int8_t*>(p);
+        return true;
+    }
+    
+    bool loaded() const {
+        return mapping.data() != nullptr;
+    }
+    
+    void setEnabled(bool value) {
+        enabled = value;
+    }
+    
+    // True when the search should use the network instead of evaluateBoard()
+    bool active() const {
+        return enabled && mapping.data() != nullptr;
+    }
+};
+
+// Shared read-only by every engine and thread in the process
+NNUENetwork nnueNetwork;
+
+// A piece added to or removed from a square by a move
+struct DirtyPiece {
+    int piece;
+    int square;
+    bool added;
+};
+
+// Feature transformer output for both perspectives at one search ply, plus
+// the piece changes of the move that led to it. Entries are filled lazily:
+// evaluation walks back to the last computed entry and replays the changes.
+struct alignas(64) Accumulator {
+    int16_t values[2][NNUE_L1];
+    bool computed[2];
+    DirtyPiece dirty[4];
+    int dirtyCount;
+};
+
+// Index of (piece on sq) among the features of the given perspective
+inline int nnueFeature(int perspective, int kingSq, int piece, int sq) {
+    int flip = perspective == 0 ? 0 : 56;
+    int type = piece > 6 ? piece - 6 : piece;
+    bool own = (piece > 6) == bool(perspective);
+    int pieceIndex = own ? type - 1 : type + 4;
+    return (kingSq ^ flip) * 640 + pieceIndex * 64 + (sq ^ flip);
+}
+
+// SIMD kernels with a scalar fallback. The AVX2 and SSE4.1 paths are chosen at
+// compile time (-mavx2 / -msse4.1, or -march=native).
+inline void nnueAddColumn(int16_t* acc, const int16_t* column) {
+#if defined(__AVX2__)
+    for (int i = 0; i < NNUE_L1; i += 16) {
+        __m256i a = _mm256_load_si256(reinterpret_cast<const __m256i*>(acc + i));
+        __m256i w = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(column + i));
+        _mm256_store_si256(reinterpret_cast<__m256i*>(acc + i), _mm256_add_epi16(a, w));
+    }
+#elif defined(__SSE4_1__)
+    for (int i = 0; i < NNUE_L1; i += 8) {
+        __m128i a = _mm_load_si128(reinterpret_cast<const __m128i*>(acc + i));
+        __m128i w = _mm_loadu_si128(reinterpret_cast<const __m128i*>(column + i));
+        _mm_store_si128(reinterpret_cast<__m128i*>(acc + i), _mm_add_epi16(a, w));
+    }
+#else
+    for (int i = 0; i < NNUE_L1; i++) {
+        acc[i] = int16_t(acc[i] + column[i]);
+    }
+#endif
+}
+
+inline void nnueSubColumn(int16_t* acc, const int16_t* column) {
+#if defined(__AVX2__)
+    for (int i = 0; i < NNUE_L1; i += 16) {
+        __m256i a = _mm256_load_si256(reinterpret_cast<const __m256i*>(acc + i));
+        __m256i w = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(column + i));
+        _mm256_store_si256(reinterpret_cast<__m256i*>(acc + i), _mm256_sub_epi16(a, w));
+    }
+#elif defined(__SSE4_1__)
+    for (int i = 0; i < NNUE_L1; i += 8) {
+        __m128i a = _mm_load_si128(reinterpret_cast<const __m128i*>(acc + i));
+        __m128i w = _mm_loadu_si128(reinterpret_cast<const __m128i*>(column + i));
+        _mm_store_si128(reinterpret_cast<__m128i*>(acc + i), _mm_sub_epi16(a, w));
+    }
+#else
+    for (int i = 0; i < NNUE_L1; i++) {
+        acc[i] = int16_t(acc[i] - column[i]);
+    }
+#endif
+}
+
+// Clips NNUE_L1 int16 values to [0, 127] and stores them as bytes
+inline void nnueClipAccumulator(uint8_t* out, const int16_t* acc) {
+#if defined(__AVX2__)
+    const __m256i zero = _mm256_setzero_si256();
+    for (int i = 0; i < NNUE_L1; i += 32) {
+        __m256i a = _mm256_load_si256(reinterpret_cast<const __m256i*>(acc + i));
+        __m256i b = _mm256_load_si256(reinterpret_cast<const __m256i*>(acc + i + 16));
+        // packs saturates to [-128, 127] but interleaves the 128-bit lanes
+        __m256i packed = _mm256_max_epi8(_mm256_packs_epi16(a, b), zero);
+        packed = _mm256_permute4x64_epi64(packed, 0xD8);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), packed);
+    }
+#elif defined(__SSE4_1__)
+    const __m128i zero = _mm_setzero_si128();
+    for (int i = 0; i < NNUE_L1; i += 16) {
+        __m128i a = _mm_load_si128(reinterpret_cast<const __m128i*>(acc + i));
+        __m128i b = _mm_load_si128(reinterpret_cast<const __m128i*>(acc + i + 8));
+        __m128i packed = _mm_max_epi8(_mm_packs_epi16(a, b), zero);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), packed);
+    }
+#else
+    for (int i = 0; i < NNUE_L1; i++) {
+        out[i] = uint8_t(std::max(0, std::min(127, int(acc[i]))));
+    }
+#endif
+}
+
+// Dot product of inputSize unsigned bytes with signed byte weights
+inline int32_t nnueDot(const uint8_t* input, const int8_t* weights, int inputSize) {
+#if defined(__AVX2__)
+    const __m256i ones = _mm256_set1_epi16(1);
+    __m256i sum = _mm256_setzero_si256();
+    for (int i = 0; i < inputSize; i += 32) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(input + i));
+        __m256i w = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(weights + i));
+        __m256i products = _mm256_madd_epi16(_mm256_maddubs_epi16(a, w), ones);
+        sum = _mm256_add_epi32(sum, products);
+    }
+    __m128i half = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+    half = _mm_add_epi32(half, _mm_shuffle_epi32(half, 0x4E));
+    half = _mm_add_epi32(half, _mm_shuffle_epi32(half, 0xB1));
+    return _mm_cvtsi128_si32(half);
+#elif defined(__SSE4_1__)
+    const __m128i ones = _mm_set1_epi16(1);
+    __m128i sum = _mm_setzero_si128();
+    for (int i = 0; i < inputSize; i += 16) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + i));
+        __m128i w = _mm_loadu_si128(reinterpret_cast<const __m128i*>(weights + i));
+        sum = _mm_add_epi32(sum, _mm_madd_epi16(_mm_maddubs_epi16(a, w), ones));
+    }
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4E));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xB1));
+    return _mm_cvtsi128_si32(sum);
+#else
+    int32_t sum = 0;
+    for (int i = 0; i < inputSize; i++) {
+        sum += int32_t(input[i]) * weights[i];
+    }
+    return sum;
+#endif
+}
+
+// Fully connected int8 layer followed by a clipped ReLU
+inline void nnueHiddenLayer(uint8_t* out, const uint8_t* input, const int8_t* weights,
+                            const int32_t* biases, int inputSize, int outputSize) {
+    for (int o = 0; o < outputSize; o++) {
+        int32_t sum = biases[o] + nnueDot(input, weights + o * inputSize, inputSize);
+        out[o] = uint8_t(std::max(0, std::min(127, sum >> NNUE_WEIGHT_SHIFT)));
+    }
+}
+
+// -------------------------
+// Opening book
+// -------------------------
+// Polyglot books are sorted arrays of 16-byte big-endian entries:
+//
+//   key      uint64  Polyglot hash of the position (not our Zobrist key)
+//   move     uint16  to file (bits 0-2), to row (3-5), from file (6-8),
+//                    from row (9-11), promotion piece (12-14, 1 = knight
+//                    ... 4 = queen); castling is written as king takes rook
+//   weight   uint16  relative probability of playing the move
+//   learn    uint32  unused
+//
+// The file is mapped and searched in place, so loading does no parsing and
+// probing does no allocation.
+const size_t BOOK_ENTRY_SIZE = 16;
+
+// Random numbers of the Polyglot hash, from the format's specification:
+// 768 for (piece kind, square) where kind = 2 * (pawn 0 ... king 5) + white,
+// then 4 for the castling rights (K, Q, k, q), 8 for the en passant file and
+// one for white to move.
+const uint64_t POLYGLOT_RANDOM[781] = {
+    0x9D39247E33776D41, 0x2AF7398005AAA5C7, 0x44DB015024623547, 0x9C15F73E62A76AE2,
+    0x75834465489C0C89, 0x3290AC3A203001BF, 0x0FBBAD1F61042279, 0xE83A908FF2FB60CA,
+    0x0D7E765D58755C10, 0x1A083822CEAFE02D, 0x9605D5F0E25EC3B0, 0xD021FF5CD13A2ED5,
+    0x40BDF15D4A672E32, 0x011355146FD56395, 0x5DB4832046F3D9E5, 0x239F8B2D7FF719CC,
+    0x05D1A1AE85B49AA1, 0x679F848F6E8FC971, 0x7449BBFF801FED0B, 0x7D11CDB1C3B7ADF0,
+    0x82C7709E781EB7CC, 0xF3218F1C9510786C, 0x331478F3AF51BBE6, 0x4BB38DE5E7219443,
+    0xAA649C6EBCFD50FC, 0x8DBD98A352AFD40B, 0x87D2074B81D79217, 0x19F3C751D3E92AE1,
+    0xB4AB30F062B19ABF, 0x7B0500AC42047AC4, 0xC9452CA81A09D85D, 0x24AA6C514DA27500,
+    0x4C9F34427501B447, 0x14A68FD73C910841, 0xA71B9B83461CBD93, 0x03488B95B0F1850F,
+    0x637B2B34FF93C040, 0x09D1BC9A3DD90A94, 0x3575668334A1DD3B, 0x735E2B97A4C45A23,
+    0x18727070F1BD400B, 0x1FCBACD259BF02E7, 0xD310A7C2CE9B6555, 0xBF983FE0FE5D8244,
+    0x9F74D14F7454A824, 0x51EBDC4AB9BA3035, 0x5C82C505DB9AB0FA, 0xFCF7FE8A3430B241,
+    0x3253A729B9BA3DDE, 0x8C74C368081B3075, 0xB9BC6C87167C33E7, 0x7EF48F2B83024E20,
+    0x11D505D4C351BD7F, 0x6568FCA92C76A243, 0x4DE0B0F40F32A7B8, 0x96D693460CC37E5D,
+    0x42E240CB63689F2F, 0x6D2BDCDAE2919661, 0x42880B0236E4D951, 0x5F0F4A5898171BB6,
+    0x39F890F579F92F88, 0x93C5B5F47356388B, 0x63DC359D8D231B78, 0xEC16CA8AEA98AD76,
+    0x5355F900C2A82DC7, 0x07FB9F855A997142, 0x5093417AA8A7ED5E, 0x7BCBC38DA25A7F3C,
+    0x19FC8A768CF4B6D4, 0x637A7780DECFC0D9, 0x8249A47AEE0E41F7, 0x79AD695501E7D1E8,
+    0x14ACBAF4777D5776, 0xF145B6BECCDEA195, 0xDABF2AC8201752FC, 0x24C3C94DF9C8D3F6,
+    0xBB6E2924F03912EA, 0x0CE26C0B95C980D9, 0xA49CD132BFBF7CC4, 0xE99D662AF4243939,
+    0x27E6AD7891165C3F, 0x8535F040B9744FF1, 0x54B3F4FA5F40D873, 0x72B12C32127FED2B,
+    0xEE954D3C7B411F47, 0x9A85AC909A24EAA1, 0x70AC4CD9F04F21F5, 0xF9B89D3E99A075C2,
+    0x87B3E2B2B5C907B1, 0xA366E5B8C54F48B8, 0xAE4A9346CC3F7CF2, 0x1920C04D47267BBD,
+    0x87BF02C6B49E2AE9, 0x092237AC237F3859, 0xFF07F64EF8ED14D0, 0x8DE8DCA9F03CC54E,
+    0x9C1633264DB49C89, 0xB3F22C3D0B0B38ED, 0x390E5FB44D01144B, 0x5BFEA5B4712768E9,
+    0x1E1032911FA78984, 0x9A74ACB964E78CB3, 0x4F80F7A035DAFB04, 0x6304D09A0B3738C4,
+    0x2171E64683023A08, 0x5B9B63EB9CEFF80C, 0x506AACF489889342, 0x1881AFC9A3A701D6,
+    0x6503080440750644, 0xDFD395339CDBF4A7, 0xEF927DBCF00C20F2, 0x7B32F7D1E03680EC,
+    0xB9FD7620E7316243, 0x05A7E8A57DB91B77, 0xB5889C6E15630A75, 0x4A750A09CE9573F7,
+    0xCF464CEC899A2F8A, 0xF538639CE705B824, 0x3C79A0FF5580EF7F, 0xEDE6C87F8477609D,
+    0x799E81F05BC93F31, 0x86536B8CF3428A8C, 0x97D7374C60087B73, 0xA246637CFF328532,
+    0x043FCAE60CC0EBA0, 0x920E449535DD359E, 0x70EB093B15B290CC, 0x73A1921916591CBD,
+    0x56436C9FE1A1AA8D, 0xEFAC4B70633B8F81, 0xBB215798D45DF7AF, 0x45F20042F24F1768,
+    0x930F80F4E8EB7462, 0xFF6712FFCFD75EA1, 0xAE623FD67468AA70, 0xDD2C5BC84BC8D8FC,
+    0x7EED120D54CF2DD9, 0x22FE545401165F1C, 0xC91800E98FB99929, 0x808BD68E6AC10365,
+    0xDEC468145B7605F6, 0x1BEDE3A3AEF53302, 0x43539603D6C55602, 0xAA969B5C691CCB7A,
+    0xA87832D392EFEE56, 0x65942C7B3C7E11AE, 0xDED2D633CAD004F6, 0x21F08570F420E565,
+    0xB415938D7DA94E3C, 0x91B859E59ECB6350, 0x10CFF333E0ED804A, 0x28AED140BE0BB7DD,
+    0xC5CC1D89724FA456, 0x5648F680F11A2741, 0x2D255069F0B7DAB3, 0x9BC5A38EF729ABD4,
+    0xEF2F054308F6A2BC, 0xAF2042F5CC5C2858, 0x480412BAB7F5BE2A, 0xAEF3AF4A563DFE43,
+    0x19AFE59AE451497F, 0x52593803DFF1E840, 0xF4F076E65F2CE6F0, 0x11379625747D5AF3,
+    0xBCE5D2248682C115, 0x9DA4243DE836994F, 0x066F70B33FE09017, 0x4DC4DE189B671A1C,
+    0x51039AB7712457C3, 0xC07A3F80C31FB4B4, 0xB46EE9C5E64A6E7C, 0xB3819A42ABE61C87,
+    0x21A007933A522A20, 0x2DF16F761598AA4F, 0x763C4A1371B368FD, 0xF793C46702E086A0,
+    0xD7288E012AEB8D31, 0xDE336A2A4BC1C44B, 0x0BF692B38D079F23, 0x2C604A7A177326B3,
+    0x4850E73E03EB6064, 0xCFC447F1E53C8E1B, 0xB05CA3F564268D99, 0x9AE182C8BC9474E8,
+    0xA4FC4BD4FC5558CA, 0xE755178D58FC4E76, 0x69B97DB1A4C03DFE, 0xF9B5B7C4ACC67C96,
+    0xFC6A82D64B8655FB, 0x9C684CB6C4D24417, 0x8EC97D2917456ED0, 0x6703DF9D2924E97E,
+    0xC547F57E42A7444E, 0x78E37644E7CAD29E, 0xFE9A44E9362F05FA, 0x08BD35CC38336615,
+    0x9315E5EB3A129ACE, 0x94061B871E04DF75, 0xDF1D9F9D784BA010, 0x3BBA57B68871B59D,
+    0xD2B7ADEEDED1F73F, 0xF7A255D83BC373F8, 0xD7F4F2448C0CEB81, 0xD95BE88CD210FFA7,
+    0x336F52F8FF4728E7, 0xA74049DAC312AC71, 0xA2F61BB6E437FDB5, 0x4F2A5CB07F6A35B3,
+    0x87D380BDA5BF7859, 0x16B9F7E06C453A21, 0x7BA2484C8A0FD54E, 0xF3A678CAD9A2E38C,
+    0x39B0BF7DDE437BA2, 0xFCAF55C1BF8A4424, 0x18FCF680573FA594, 0x4C0563B89F495AC3,
+    0x40E087931A00930D, 0x8CFFA9412EB642C1, 0x68CA39053261169F, 0x7A1EE967D27579E2,
+    0x9D1D60E5076F5B6F, 0x3810E399B6F65BA2, 0x32095B6D4AB5F9B1, 0x35CAB62109DD038A,
+    0xA90B24499FCFAFB1, 0x77A225A07CC2C6BD, 0x513E5E634C70E331, 0x4361C0CA3F692F12,
+    0xD941ACA44B20A45B, 0x528F7C8602C5807B, 0x52AB92BEB9613989, 0x9D1DFA2EFC557F73,
+    0x722FF175F572C348, 0x1D1260A51107FE97, 0x7A249A57EC0C9BA2, 0x04208FE9E8F7F2D6,
+    0x5A110C6058B920A0, 0x0CD9A497658A5698, 0x56FD23C8F9715A4C, 0x284C847B9D887AAE,
+    0x04FEABFBBDB619CB, 0x742E1E651C60BA83, 0x9A9632E65904AD3C, 0x881B82A13B51B9E2,
+    0x506E6744CD974924, 0xB0183DB56FFC6A79, 0x0ED9B915C66ED37E, 0x5E11E86D5873D484,
+    0xF678647E3519AC6E, 0x1B85D488D0F20CC5, 0xDAB9FE6525D89021, 0x0D151D86ADB73615,
+    0xA865A54EDCC0F019, 0x93C42566AEF98FFB, 0x99E7AFEABE000731, 0x48CBFF086DDF285A,
+    0x7F9B6AF1EBF78BAF, 0x58627E1A149BBA21, 0x2CD16E2ABD791E33, 0xD363EFF5F0977996,
+    0x0CE2A38C344A6EED, 0x1A804AADB9CFA741, 0x907F30421D78C5DE, 0x501F65EDB3034D07,
+    0x37624AE5A48FA6E9, 0x957BAF61700CFF4E, 0x3A6C27934E31188A, 0xD49503536ABCA345,
+    0x088E049589C432E0, 0xF943AEE7FEBF21B8, 0x6C3B8E3E336139D3, 0x364F6FFA464EE52E,
+    0xD60F6DCEDC314222, 0x56963B0DCA418FC0, 0x16F50EDF91E513AF, 0xEF1955914B609F93,
+    0x565601C0364E3228, 0xECB53939887E8175, 0xBAC7A9A18531294B, 0xB344C470397BBA52,
+    0x65D34954DAF3CEBD, 0xB4B81B3FA97511E2, 0xB422061193D6F6A7, 0x071582401C38434D,
+    0x7A13F18BBEDC4FF5, 0xBC4097B116C524D2, 0x59B97885E2F2EA28, 0x99170A5DC3115544,
+    0x6F423357E7C6A9F9, 0x325928EE6E6F8794, 0xD0E4366228B03343, 0x565C31F7DE89EA27,
+    0x30F5611484119414, 0xD873DB391292ED4F, 0x7BD94E1D8E17DEBC, 0xC7D9F16864A76E94,
+    0x947AE053EE56E63C, 0xC8C93882F9475F5F, 0x3A9BF55BA91F81CA, 0xD9A11FBB3D9808E4,
+    0x0FD22063EDC29FCA, 0xB3F256D8ACA0B0B9, 0xB03031A8B4516E84, 0x35DD37D5871448AF,
+    0xE9F6082B05542E4E, 0xEBFAFA33D7254B59, 0x9255ABB50D532280, 0xB9AB4CE57F2D34F3,
+    0x693501D628297551, 0xC62C58F97DD949BF, 0xCD454F8F19C5126A, 0xBBE83F4ECC2BDECB,
+    0xDC842B7E2819E230, 0xBA89142E007503B8, 0xA3BC941D0A5061CB, 0xE9F6760E32CD8021,
+    0x09C7E552BC76492F, 0x852F54934DA55CC9, 0x8107FCCF064FCF56, 0x098954D51FFF6580,
+    0x23B70EDB1955C4BF, 0xC330DE426430F69D, 0x4715ED43E8A45C0A, 0xA8D7E4DAB780A08D,
+    0x0572B974F03CE0BB, 0xB57D2E985E1419C7, 0xE8D9ECBE2CF3D73F, 0x2FE4B17170E59750,
+    0x11317BA87905E790, 0x7FBF21EC8A1F45EC, 0x1725CABFCB045B00, 0x964E915CD5E2B207,
+    0x3E2B8BCBF016D66D, 0xBE7444E39328A0AC, 0xF85B2B4FBCDE44B7, 0x49353FEA39BA63B1,
+    0x1DD01AAFCD53486A, 0x1FCA8A92FD719F85, 0xFC7C95D827357AFA, 0x18A6A990C8B35EBD,
+    0xCCCB7005C6B9C28D, 0x3BDBB92C43B17F26, 0xAA70B5B4F89695A2, 0xE94C39A54A98307F,
+    0xB7A0B174CFF6F36E, 0xD4DBA84729AF48AD, 0x2E18BC1AD9704A68, 0x2DE0966DAF2F8B1C,
+    0xB9C11D5B1E43A07E, 0x64972D68DEE33360, 0x94628D38D0C20584, 0xDBC0D2B6AB90A559,
+    0xD2733C4335C6A72F, 0x7E75D99D94A70F4D, 0x6CED1983376FA72B, 0x97FCAACBF030BC24,
+    0x7B77497B32503B12, 0x8547EDDFB81CCB94, 0x79999CDFF70902CB, 0xCFFE1939438E9B24,
+    0x829626E3892D95D7, 0x92FAE24291F2B3F1, 0x63E22C147B9C3403, 0xC678B6D860284A1C,
+    0x5873888850659AE7, 0x0981DCD296A8736D, 0x9F65789A6509A440, 0x9FF38FED72E9052F,
+    0xE479EE5B9930578C, 0xE7F28ECD2D49EECD, 0x56C074A581EA17FE, 0x5544F7D774B14AEF,
+    0x7B3F0195FC6F290F, 0x12153635B2C0CF57, 0x7F5126DBBA5E0CA7, 0x7A76956C3EAFB413,
+    0x3D5774A11D31AB39, 0x8A1B083821F40CB4, 0x7B4A38E32537DF62, 0x950113646D1D6E03,
+    0x4DA8979A0041E8A9, 0x3BC36E078F7515D7, 0x5D0A12F27AD310D1, 0x7F9D1A2E1EBE1327,
+    0xDA3A361B1C5157B1, 0xDCDD7D20903D0C25, 0x36833336D068F707, 0xCE68341F79893389,
+    0xAB9090168DD05F34, 0x43954B3252DC25E5, 0xB438C2B67F98E5E9, 0x10DCD78E3851A492,
+    0xDBC27AB5447822BF, 0x9B3CDB65F82CA382, 0xB67B7896167B4C84, 0xBFCED1B0048EAC50,
+    0xA9119B60369FFEBD, 0x1FFF7AC80904BF45, 0xAC12FB171817EEE7, 0xAF08DA9177DDA93D,
+    0x1B0CAB936E65C744, 0xB559EB1D04E5E932, 0xC37B45B3F8D6F2BA, 0xC3A9DC228CAAC9E9,
+    0xF3B8B6675A6507FF, 0x9FC477DE4ED681DA, 0x67378D8ECCEF96CB, 0x6DD856D94D259236,
+    0xA319CE15B0B4DB31, 0x073973751F12DD5E, 0x8A8E849EB32781A5, 0xE1925C71285279F5,
+    0x74C04BF1790C0EFE, 0x4DDA48153C94938A, 0x9D266D6A1CC0542C, 0x7440FB816508C4FE,
+    0x13328503DF48229F, 0xD6BF7BAEE43CAC40, 0x4838D65F6EF6748F, 0x1E152328F3318DEA,
+    0x8F8419A348F296BF, 0x72C8834A5957B511, 0xD7A023A73260B45C, 0x94EBC8ABCFB56DAE,
+    0x9FC10D0F989993E0, 0xDE68A2355B93CAE6, 0xA44CFE79AE538BBE, 0x9D1D84FCCE371425,
+    0x51D2B1AB2DDFB636, 0x2FD7E4B9E72CD38C, 0x65CA5B96B7552210, 0xDD69A0D8AB3B546D,
+    0x604D51B25FBF70E2, 0x73AA8A564FB7AC9E, 0x1A8C1E992B941148, 0xAAC40A2703D9BEA0,
+    0x764DBEAE7FA4F3A6, 0x1E99B96E70A9BE8B, 0x2C5E9DEB57EF4743, 0x3A938FEE32D29981,
+    0x26E6DB8FFDF5ADFE, 0x469356C504EC9F9D, 0xC8763C5B08D1908C, 0x3F6C6AF859D80055,
+    0x7F7CC39420A3A545, 0x9BFB227EBDF4C5CE, 0x89039D79D6FC5C5C, 0x8FE88B57305E2AB6,
+    0xA09E8C8C35AB96DE, 0xFA7E393983325753, 0xD6B6D0ECC617C699, 0xDFEA21EA9E7557E3,
+    0xB67C1FA481680AF8, 0xCA1E3785A9E724E5, 0x1CFC8BED0D681639, 0xD18D8549D140CAEA,
+    0x66C1A2A1A60CD889, 0x9E17E49642A3E4C1, 0xEDB454E7BADC0805, 0x50B704CAB602C329,
+    0x4CC317FB9CDDD023, 0x66B4835D9EAFEA22, 0x219B97E26FFC81BD, 0x261E4E4C0A333A9D,
+    0x4ED0FE7E9DC91335, 0xE4DBF0634473F5D2, 0x1761F93A44D5AEFE, 0x53898E4C3910DA55,
+    0x734DE8181F6EC39A, 0x2680B122BAA28D97, 0x298AF231C85BAFAB, 0x7983EED3740847D5,
+    0x1FE2CCA76517DB90, 0xD7504DFA8816EDBB, 0xB9571FA04DC089C8, 0x1DDC0325259B27DE,
+    0xCF3F4688801EB9AA, 0xF4F5D05C10CAB243, 0x38B6525C21A42B0E, 0x36F60E2BA4FA6800,
+    0xEB3593803173E0CE, 0x9C4CD6257C5A3603, 0xAF0C317D32ADAA8A, 0x258E5A80C7204C4B,
+    0x8B889D624D44885D, 0xF4D14597E660F855, 0xD4347F66EC8941C3, 0xE699ED85B0DFB40D,
+    0x2472F6207C2D0484, 0xC2A1E7B5B459AEB5, 0xAB4F6451CC1D45EC, 0x63767572AE3D6174,
+    0xA59E0BD101731A28, 0x116D0016CB948F09, 0x2CF9C8CA052F6E9F, 0x0B090A7560A968E3,
+    0xABEEDDB2DDE06FF1, 0x58EFC10B06A2068D, 0xC6E57A78FBD986E0, 0x2EAB8CA63CE802D7,
+    0x14A195640116F336, 0x7C0828DD624EC390, 0xD74BBE77E6116AC7, 0x804456AF10F5FB53,
+    0xEBE9EA2ADF4321C7, 0x03219A39EE587A30, 0x49787FEF17AF9924, 0xA1E9300CD8520548,
+    0x5B45E522E4B1B4EF, 0xB49C3B3995091A36, 0xD4490AD526F14431, 0x12A8F216AF9418C2,
+    0x001F837CC7350524, 0x1877B51E57A764D5, 0xA2853B80F17F58EE, 0x993E1DE72D36D310,
+    0xB3598080CE64A656, 0x252F59CF0D9F04BB, 0xD23C8E176D113600, 0x1BDA0492E7E4586E,
+    0x21E0BD5026C619BF, 0x3B097ADAF088F94E, 0x8D14DEDB30BE846E, 0xF95CFFA23AF5F6F4,
+    0x3871700761B3F743, 0xCA672B91E9E4FA16, 0x64C8E531BFF53B55, 0x241260ED4AD1E87D,
+    0x106C09B972D2E822, 0x7FBA195410E5CA30, 0x7884D9BC6CB569D8, 0x0647DFEDCD894A29,
+    0x63573FF03E224774, 0x4FC8E9560F91B123, 0x1DB956E450275779, 0xB8D91274B9E9D4FB,
+    0xA2EBEE47E2FBFCE1, 0xD9F1F30CCD97FB09, 0xEFED53D75FD64E6B, 0x2E6D02C36017F67F,
+    0xA9AA4D20DB084E9B, 0xB64BE8D8B25396C1, 0x70CB6AF7C2D5BCF0, 0x98F076A4F7A2322E,
+    0xBF84470805E69B5F, 0x94C3251F06F90CF3, 0x3E003E616A6591E9, 0xB925A6CD0421AFF3,
+    0x61BDD1307C66E300, 0xBF8D5108E27E0D48, 0x240AB57A8B888B20, 0xFC87614BAF287E07,
+    0xEF02CDD06FFDB432, 0xA1082C0466DF6C0A, 0x8215E577001332C8, 0xD39BB9C3A48DB6CF,
+    0x2738259634305C14, 0x61CF4F94C97DF93D, 0x1B6BACA2AE4E125B, 0x758F450C88572E0B,
+    0x959F587D507A8359, 0xB063E962E045F54D, 0x60E8ED72C0DFF5D1, 0x7B64978555326F9F,
+    0xFD080D236DA814BA, 0x8C90FD9B083F4558, 0x106F72FE81E2C590, 0x7976033A39F7D952,
+    0xA4EC0132764CA04B, 0x733EA705FAE4FA77, 0xB4D8F77BC3E56167, 0x9E21F4F903B33FD9,
+    0x9D765E419FB69F6D, 0xD30C088BA61EA5EF, 0x5D94337FBFAF7F5B, 0x1A4E4822EB4D7A59,
+    0x6FFE73E81B637FB3, 0xDDF957BC36D8B9CA, 0x64D0E29EEA8838B3, 0x08DD9BDFD96B9F63,
+    0x087E79E5A57D1D13, 0xE328E230E3E2B3FB, 0x1C2559E30F0946BE, 0x720BF5F26F4D2EAA,
+    0xB0774D261CC609DB, 0x443F64EC5A371195, 0x4112CF68649A260E, 0xD813F2FAB7F5C5CA,
+    0x660D3257380841EE, 0x59AC2C7873F910A3, 0xE846963877671A17, 0x93B633ABFA3469F8,
+    0xC0C0F5A60EF4CDCF, 0xCAF21ECD4377B28C, 0x57277707199B8175, 0x506C11B9D90E8B1D,
+    0xD83CC2687A19255F, 0x4A29C6465A314CD1, 0xED2DF21216235097, 0xB5635C95FF7296E2,
+    0x22AF003AB672E811, 0x52E762596BF68235, 0x9AEBA33AC6ECC6B0, 0x944F6DE09134DFB6,
+    0x6C47BEC883A7DE39, 0x6AD047C430A12104, 0xA5B1CFDBA0AB4067, 0x7C45D833AFF07862,
+    0x5092EF950A16DA0B, 0x9338E69C052B8E7B, 0x455A4B4CFE30E3F5, 0x6B02E63195AD0CF8,
+    0x6B17B224BAD6BF27, 0xD1E0CCD25BB9C169, 0xDE0C89A556B9AE70, 0x50065E535A213CF6,
+    0x9C1169FA2777B874, 0x78EDEFD694AF1EED, 0x6DC93D9526A50E68, 0xEE97F453F06791ED,
+    0x32AB0EDB696703D3, 0x3A6853C7E70757A7, 0x31865CED6120F37D, 0x67FEF95D92607890,
+    0x1F2B1D1F15F6DC9C, 0xB69E38A8965C6B65, 0xAA9119FF184CCCF4, 0xF43C732873F24C13,
+    0xFB4A3D794A9A80D2, 0x3550C2321FD6109C, 0x371F77E76BB8417E, 0x6BFA9AAE5EC05779,
+    0xCD04F3FF001A4778, 0xE3273522064480CA, 0x9F91508BFFCFC14A, 0x049A7F41061A9E60,
+    0xFCB6BE43A9F2FE9B, 0x08DE8A1C7797DA9B, 0x8F9887E6078735A1, 0xB5B4071DBFC73A66,
+    0x230E343DFBA08D33, 0x43ED7F5A0FAE657D, 0x3A88A0FBBCB05C63, 0x21874B8B4D2DBC4F,
+    0x1BDEA12E35F6A8C9, 0x53C065C6C8E63528, 0xE34A1D250E7A8D6B, 0xD6B04D3B7651DD7E,
+    0x5E90277E7CB39E2D, 0x2C046F22062DC67D, 0xB10BB459132D0A26, 0x3FA9DDFB67E2F199,
+    0x0E09B88E1914F7AF, 0x10E8B35AF3EEAB37, 0x9EEDECA8E272B933, 0xD4C718BC4AE8AE5F,
+    0x81536D601170FC20, 0x91B534F885818A06, 0xEC8177F83F900978, 0x190E714FADA5156E,
+    0xB592BF39B0364963, 0x89C350C893AE7DC1, 0xAC042E70F8B383F2, 0xB49B52E587A1EE60,
+    0xFB152FE3FF26DA89, 0x3E666E6F69AE2C15, 0x3B544EBE544C19F9, 0xE805A1E290CF2456,
+    0x24B33C9D7ED25117, 0xE74733427B72F0C1, 0x0A804D18B7097475, 0x57E3306D881EDB4F,
+    0x4AE7D6A36EB5DBCB, 0x2D8D5432157064C8, 0xD1E649DE1E7F268B, 0x8A328A1CEDFE552C,
+    0x07A3AEC79624C7DA, 0x84547DDC3E203C94, 0x990A98FD5071D263, 0x1A4FF12616EEFC89,
+    0xF6F7FD1431714200, 0x30C05B1BA332F41C, 0x8D2636B81555A786, 0x46C9FEB55D120902,
+    0xCCEC0A73B49C9921, 0x4E9D2827355FC492, 0x19EBB029435DCB0F, 0x4659D2B743848A2C,
+    0x963EF2C96B33BE31, 0x74F85198B05A2E7D, 0x5A0F544DD2B1FB18, 0x03727073C2E134B1,
+    0xC7F6AA2DE59AEA61, 0x352787BAA0D7C22F, 0x9853EAB63B5E0B35, 0xABBDCDD7ED5C0860,
+    0xCF05DAF5AC8D77B0, 0x49CAD48CEBF4A71E, 0x7A4C10EC2158C4A6, 0xD9E92AA246BF719E,
+    0x13AE978D09FE5557, 0x730499AF921549FF, 0x4E4B705B92903BA4, 0xFF577222C14F0A3A,
+    0x55B6344CF97AAFAE, 0xB862225B055B6960, 0xCAC09AFBDDD2CDB4, 0xDAF8E9829FE96B5F,
+    0xB5FDFC5D3132C498, 0x310CB380DB6F7503, 0xE87FBB46217A360E, 0x2102AE466EBB1148,
+    0xF8549E1A3AA5E00D, 0x07A69AFDCC42261A, 0xC4C118BFE78FEAAE, 0xF9F4892ED96BD438,
+    0x1AF3DBE25D8F45DA, 0xF5B4B0B0D2DEEEB4, 0x962ACEEFA82E1C84, 0x046E3ECAAF453CE9,
+    0xF05D129681949A4C, 0x964781CE734B3C84, 0x9C2ED44081CE5FBD, 0x522E23F3925E319E,
+    0x177E00F9FC32F791, 0x2BC60A63A6F3B3F2, 0x222BBFAE61725606, 0x486289DDCC3D6780,
+    0x7DC7785B8EFDFC80, 0x8AF38731C02BA980, 0x1FAB64EA29A2DDF7, 0xE4D9429322CD065A,
+    0x9DA058C67844F20C, 0x24C0E332B70019B0, 0x233003B5A6CFE6AD, 0xD586BD01C5C217F6,
+    0x5E5637885F29BC2B, 0x7EBA726D8C94094B, 0x0A56A5F0BFE39272, 0xD79476A84EE20D06,
+    0x9E4C1269BAA4BF37, 0x17EFEE45B0DEE640, 0x1D95B0A5FCF90BC6, 0x93CBE0B699C2585D,
+    0x65FA4F227A2B6D79, 0xD5F9E858292504D5, 0xC2B5A03F71471A6F, 0x59300222B4561E00,
+    0xCE2F8642CA0712DC, 0x7CA9723FBB2E8988, 0x2785338347F2BA08, 0xC61BB3A141E50E8C,
+    0x150F361DAB9DEC26, 0x9F6A419D382595F4, 0x64A53DC924FE7AC9, 0x142DE49FFF7A7C3D,
+    0x0C335248857FA9E7, 0x0A9C32D5EAE45305, 0xE6C42178C4BBB92E, 0x71F1CE2490D20B07,
+    0xF1BCC3D275AFE51A, 0xE728E8C83C334074, 0x96FBF83A12884624, 0x81A1549FD6573DA5,
+    0x5FA7867CAF35E149, 0x56986E2EF3ED091B, 0x917F1DD5F8886C61, 0xD20D8C88C8FFE65F,
+    0x31D71DCE64B2C310, 0xF165B587DF898190, 0xA57E6339DD2CF3A0, 0x1EF6E6DBB1961EC9,
+    0x70CC73D90BC26E24, 0xE21A6B35DF0C3AD7, 0x003A93D8B2806962, 0x1C99DED33CB890A1,
+    0xCF3145DE0ADD4289, 0xD0E4427A5514FB72, 0x77C621CC9FB3A483, 0x67A34DAC4356550B,
+    0xF8D626AAAF278509
+};
+const int POLYGLOT_CASTLING = 768;
+const int POLYGLOT_EN_PASSANT = 772;
+const int POLYGLOT_TURN = 780;
+
+class PolyglotBook {
+    MappedFile mapping;
+    size_t entryCount = 0;
+    
+    static uint64_t readBigEndian(const char* p, int bytes) {
+        uint64_t value = 0;
+        for (int i = 0; i < bytes; i++) {
+            value = (value << 8) | uint8_t(p[i]);
+        }
+        return value;
+    }
+    
+    const char* entry(size_t index) const {
+        return mapping.data() + index * BOOK_ENTRY_SIZE;
+    }
+    
+public:
+    // Maps a book file read-only. Returns false (and keeps the previous book,
+    // if any) when the file is missing or not a whole number of entries.
+    bool load(const std::string& path) {
+        MappedFile file;
+        if (!file.open(path) || file.size() % BOOK_ENTRY_SIZE != 0) {
+            return false;
+        }
+        mapping.swap(file);
+        entryCount = mapping.size() / BOOK_ENTRY_SIZE;
+        return true;
+    }
+    
+    void unload() {
+        mapping.close();
+        entryCount = 0;
+    }
+    
+    bool loaded() const {
+        return entryCount != 0;
+    }
+    
+    // Picks one of the book moves of the position with the given Polyglot key,
+    // with probability proportional to its weight, using random to choose.
+    // Returns the move in Polyglot encoding, or 0 if the position is not in
+    // the book.
+    uint16_t probe(uint64_t key, uint32_t random) const {
+        // Binary search for the first entry with the key
+        size_t low = 0, high = entryCount;
+        while (low < high) {
+            size_t mid = (low + high) / 2;
+            if (readBigEndian(entry(mid), 8) < key) {
+                low = mid + 1;
+            } else {
+                high = mid;
+            }
+        }
+        
+        // The position's moves follow each other; a second pass over them
+        // picks one without storing the list
+        uint32_t totalWeight = 0;
+        size_t end = low;
+        for (; end < entryCount && readBigEndian(entry(end), 8) == key; end++) {
+            totalWeight += uint32_t(readBigEndian(entry(end) + 10, 2));
+        }
+        if (end == low) {
+            return 0;
+        }
+        if (totalWeight == 0) {
+            return uint16_t(readBigEndian(entry(low) + 8, 2));
+        }
+        
+        uint32_t pick = random % totalWeight;
+        for (size_t i = low; i < end; i++) {
+            uint32_t weight = uint32_t(readBigEndian(entry(i) + 10, 2));
+            if (pick < weight) {
+                return uint16_t(readBigEndian(entry(i) + 8, 2));
+            }
+            pick -= weight;
+        }
+        return uint16_t(readBigEndian(entry(end - 1) + 8, 2));
+    }
+};
+
+// Shared read-only by every engine in the process
+PolyglotBook openingBook;
+
+// -------------------------
+// Syzygy tablebases
+// -------------------------
+// Probing of Syzygy endgame tablebases, following Ronald de Man's reference
+// implementation. A WDL file (.rtbw) stores the win/draw/loss value of every
+// placement of its pieces and a DTZ file (.rtbz) the distance, in plies or
+// moves, to the next capture or pawn move of the winning line ("zeroing", as
+// it resets the 50-move counter). The values are compressed with Recursive
+// Pairing followed by a canonical Huffman code, in fixed-size blocks that are
+// decoded in place from the mapped file.
+//
+// "setoption name SyzygyPath" only checks which WDL files exist; a file is
+// mapped and its headers are read the first time a position needs it.
+const int TB_PIECES = 7;  // Largest tables supported
+
+// Value of a position with the side to move first. A cursed win or blessed
+// loss is a win or loss that the 50-move rule turns into a draw.
+enum WDLScore {
+    WDL_LOSS = -2,
+    WDL_BLESSED_LOSS = -1,
+    WDL_DRAW = 0,
+    WDL_CURSED_WIN = 1,
+    WDL_WIN = 2
+};
+
+enum TBProbeState {
+    TB_FAIL = 0,               // No table, or the table could not be mapped
+    TB_OK = 1,
+    TB_CHANGE_STM = -1,        // The DTZ table only stores the other side to move
+    TB_ZEROING_BEST_MOVE = 2   // The best move zeroes, so the DTZ table has no value
+};
+
+enum TBType {
+    TB_WDL,
+    TB_DTZ
+};
+
+// Per-table flags stored in the files
+enum TBFlag {
+    TB_FLAG_STM = 1,
+    TB_FLAG_MAPPED = 2,
+    TB_FLAG_WIN_PLIES = 4,
+    TB_FLAG_LOSS_PLIES = 8,
+    TB_FLAG_WIDE = 16,
+    TB_FLAG_SINGLE_VALUE = 128
+};
+
+// DTZ tables hold no values for zeroing moves, but the DTZ just before one
+// follows from the WDL value after it
+inline int dtzBeforeZeroing(int wdl) {
+    return wdl == WDL_WIN ? 1
+         : wdl == WDL_CURSED_WIN ? 101
+         : wdl == WDL_BLESSED_LOSS ? -101
+         : wdl == WDL_LOSS ? -1 : 0;
+}
+
+// Index tables of the position encoding, filled by initTablebaseTables()
+int tbMapPawns[64];
+int tbMapB1H1H7[64];
+int tbMapA1D1D4[64];
+int tbMapKK[10][64];
+int tbBinomial[6][64];         // tbBinomial[k][n]: ways to choose k of n squares
+int tbLeadPawnIdx[6][64];      // [lead pawn count][square]
+int tbLeadPawnsSize[6][4];     // [lead pawn count][file a-d]
+
+// Distance of a square from the a1-h8 diagonal, negative below it
+inline int tbOffA1H8(int sq) {
+    return (sq >> 3) - (sq & 7);
+}
+
+inline uint64_t tbReadLE(const uint8_t* p, int bytes) {
+    uint64_t value = 0;
+    for (int i = bytes - 1; i >= 0; i--) {
+        value = (value << 8) | p[i];
+    }
+    return value;
+}
+
+inline uint64_t tbReadBE(const uint8_t* p, int bytes) {
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; i++) {
+        value = (value << 8) | p[i];
+    }
+    return value;
+}
+
+void initTablebaseTables() {
+    static std::once_flag initialized;
+    
+    std::call_once(initialized, [] {
+        // Squares below the a1-h8 diagonal, numbered 0..27
+        int code = 0;
+        for (int sq = 0; sq < 64; sq++) {
+            if (tbOffA1H8(sq) < 0) {
+                tbMapB1H1H7[sq] = code++;
+            }
+        }
+        
+        // The a1-d1-d4 triangle, numbered 0..9 with the diagonal squares last
+        std::vector<int> diagonal;
+        code = 0;
+        for (int sq = 0; sq <= 27; sq++) {
+            if (tbOffA1H8(sq) < 0 && (sq & 7) <= 3) {
+                tbMapA1D1D4[sq] = code++;
+            } else if (tbOffA1H8(sq) == 0 && (sq & 7) <= 3) {
+                diagonal.push_back(sq);
+            }
+        }
+        for (int sq : diagonal) {
+            tbMapA1D1D4[sq] = code++;
+        }
+        
+        // The 462 legal placements of two kings with the first one in the
+        // a1-d1-d4 triangle. When the first king is on the diagonal, the second
+        // is not above it; placements with both on the diagonal come last.
+        std::vector<std::pair<int, int>> bothOnDiagonal;
+        code = 0;
+        for (int idx = 0; idx < 10; idx++) {
+            for (int s1 = 0; s1 <= 27; s1++) {
+                if (tbMapA1D1D4[s1] != idx || (idx == 0 && s1 != 1)) {
+                    continue;  // b1 is the only square mapped to 0
+                }
+                for (int s2 = 0; s2 < 64; s2++) {
+                    if (std::abs((s1 >> 3) - (s2 >> 3)) <= 1 && std::abs((s1 & 7) - (s2 & 7)) <= 1) {
+                        continue;  // Same or adjacent squares
+                    }
+                    if (tbOffA1H8(s1) == 0 && tbOffA1H8(s2) > 0) {
+                        continue;
+                    }
+                    if (tbOffA1H8(s1) == 0 && tbOffA1H8(s2) == 0) {
+                        bothOnDiagonal.emplace_back(idx, s2);
+                    } else {
+                        tbMapKK[idx][s2] = code++;
+                    }
+                }
+            }
+        }
+        for (const auto& placement : bothOnDiagonal) {
+            tbMapKK[placement.first][placement.second] = code++;
+        }
+        
+        tbBinomial[0][0] = 1;
+        for (int n = 1; n < 64; n++) {
+            for (int k = 0; k < 6 && k <= n; k++) {
+                tbBinomial[k][n] = (k > 0 ? tbBinomial[k - 1][n - 1] : 0)
+                                 + (k < n ? tbBinomial[k][n - 1] : 0);
+            }
+        }
+        
+        // tbMapPawns numbers a2-h7 so that the leading pawn (nearest the edge,
+        // then lowest) has the highest value: 47 for a2, 46 for h2, 45 for a3...
+        int availableSquares = 47;
+        for (int leadPawns = 1; leadPawns <= 5; leadPawns++) {
+            for (int file = 0; file < 4; file++) {
+                int idx = 0;
+                for (int row = 1; row <= 6; row++) {
+                    int sq = row * 8 + file;
+                    if (leadPawns == 1) {
+                        tbMapPawns[sq] = availableSquares--;
+                        tbMapPawns[sq ^ 7] = availableSquares--;
+                    }
+                    tbLeadPawnIdx[leadPawns][sq] = idx;
+                    idx += tbBinomial[leadPawns - 1][tbMapPawns[sq]];
+                }
+                tbLeadPawnsSize[leadPawns][file] = idx;
+            }
+        }
+    });
+}
+
+// Identifies a material configuration, four bits per (color, piece type)
+// count with kings left out. counts[color][type] uses types 1 (pawn) to 5.
+inline uint64_t tbMaterialKey(const int counts[2][7], bool swapColors) {
+    uint64_t result = 0;
+    for (int color = 0; color < 2; color++) {
+        for (int type = 1; type <= 5; type++) {
+            result |= uint64_t(counts[color ^ swapColors][type]) << (4 * (type - 1 + 5 * color));
+        }
+    }
+    return result;
+}
+
+// Low level decoding information of one value table. A file has one per side
+// to move (WDL tables of non-symmetric material) and per file of the leading
+// pawn (tables with pawns). Pointers point into the mapping.
+struct PairsData {
+    uint8_t flags;
+    uint8_t maxSymLen;            // Longest and shortest Huffman code lengths
+    uint8_t minSymLen;
+    uint32_t numBlocks;
+    size_t blockSize;
+    size_t span;                  // Distance between sparse index entries
+    const uint8_t* lowestSym;     // uint16 per code length: lowest symbol of that length
+    const uint8_t* btree;         // 3 bytes per symbol: the pair it expands to
+    const uint8_t* blockLength;   // uint16 per block: values stored in it, minus one
+    uint32_t blockLengthSize;
+    const uint8_t* sparseIndex;   // 6 bytes per entry: uint32 block, uint16 offset
+    size_t sparseIndexSize;
+    const uint8_t* data;          // Start of the compressed blocks
+    std::vector<uint64_t> base64; // Lowest code of each length, left aligned in 64 bits
+    std::vector<uint8_t> symlen;  // Number of values a symbol expands to, minus one
+    int pieces[TB_PIECES];        // Piece order of the encoding (tablebase piece codes)
+    uint64_t groupIdx[TB_PIECES + 1];
+    int groupLen[TB_PIECES + 1];  // Pieces encoded together, zero terminated
+    uint16_t mapIdx[4];           // DTZ value map offsets per WDL result
+};
+
+// One WDL or DTZ file. Everything but the PairsData is known from the file
+// name; the rest is read when the file is mapped.
+struct TBTable {
+    TBType type;
+    std::string name;  // e.g. "KRvK", strongest side first
+    uint64_t key;      // Material key with the first side white
+    uint64_t key2;     // ... and with the first side black
+    int pieceCount;
+    bool hasPawns;
+    bool hasUniquePieces;
+    uint8_t pawnCount[2];  // Leading color, other color
+    
+    std::atomic<bool> ready{ false };
+    MappedFile file;
+    const uint8_t* dtzMap = nullptr;
+    PairsData items[2][4];  // [side to move][leading pawn file]
+    
+    PairsData* get(int stm, int file) {
+        return &items[type == TB_WDL ? stm % 2 : 0][hasPawns ? file : 0];
+    }
+};
+
+class SyzygyTablebases {
+    struct Entry {
+        TBTable wdl;
+        TBTable dtz;
+    };
+    
+    std::vector<std::string> paths;
+    std::deque<Entry> entries;
+    std::unordered_map<uint64_t, Entry*> byKey;
+    int largest = 0;
+    std::mutex mapMutex;
+    
+    bool fileExists(const std::string& name, std::string& found) const {
+        for (const std::string& dir : paths) {
+            std::ifstream stream(dir + "/" + name, std::ios::binary);
+            if (stream) {
+                found = dir + "/" + name;
+                return true;
+            }
+        }
+        return false;
+    }
+    
+    // Adds the table of a kings-first piece list like "KRPvKR" if its WDL file exists
+    void add(const std::string& code) {
+        std::string found;
+        if (!fileExists(code + ".rtbw", found)) {
+            return;
+        }
+        
+        int counts[2][7] = {};
+        int color = 0;
+        for (char c : code) {
+            if (c == 'v') {
+                color = 1;
+            } else {
+                counts[color][std::string(" PNBRQK").find(c)]++;
+            }
+        }
+        
+        entries.emplace_back();
+        Entry& entry = entries.back();
+        for (TBTable* table : { &entry.wdl, &entry.dtz }) {
+            table->type = table == &entry.wdl ? TB_WDL : TB_DTZ;
+            table->name = code;
+            table->key = tbMaterialKey(counts, false);
+            table->key2 = tbMaterialKey(counts, true);
+            table->pieceCount = int(code.size()) - 1;
+            table->hasPawns = counts[0][1] + counts[1][1] > 0;
+            table->hasUniquePieces = false;
+            for (int c = 0; c < 2; c++) {
+                for (int type = 1; type <= 5; type++) {
+                    if (counts[c][type] == 1) {
+                        table->hasUniquePieces = true;
+                    }
+                }
+            }
+            
+            // The leading color is the one with fewer pawns (but some), which
+            // compresses better
+            bool whiteLeads = counts[1][1] == 0 || (counts[0][1] > 0 && counts[1][1] >= counts[0][1]);
+            table->pawnCount[0] = uint8_t(counts[whiteLeads ? 0 : 1][1]);
+            table->pawnCount[1] = uint8_t(counts[whiteLeads ? 1 : 0][1]);
+        }
+        
+        byKey[entry.wdl.key] = &entry;
+        byKey[entry.wdl.key2] = &entry;
+        largest = std::max(largest, entry.wdl.pieceCount);
+    }
+    
+    static void setGroups(TBTable& e, PairsData* d, const int order[2], int file) {
+        int n = 0;
+        int firstLen = e.hasPawns ? 0 : e.hasUniquePieces ? 3 : 2;
+        d->groupLen[n] = 1;
+        
+        // Pieces of the same kind are encoded together, and so are the first
+        // three unique pieces (or the two kings) of a pawnless table
+        for (int i = 1; i < e.pieceCount; i++) {
+            if (--firstLen > 0 || d->pieces[i] == d->pieces[i - 1]) {
+                d->groupLen[n]++;
+            } else {
+                d->groupLen[++n] = 1;
+            }
+        }
+        d->groupLen[++n] = 0;
+        
+        // The index is a mixed-radix number with one digit per group. The
+        // order of the digits is stored in the file: order[0] is the position
+        // of the leading group and order[1] that of the other side's pawns.
+        bool pawnsOnBothSides = e.hasPawns && e.pawnCount[1];
+        int next = pawnsOnBothSides ? 2 : 1;
+        int freeSquares = 64 - d->groupLen[0] - (pawnsOnBothSides ? d->groupLen[1] : 0);
+        uint64_t idx = 1;
+        
+        for (int k = 0; next < n || k == order[0] || k == order[1]; k++) {
+            if (k == order[0]) {
+                d->groupIdx[0] = idx;
+                idx *= e.hasPawns ? tbLeadPawnsSize[d->groupLen[0]][file]
+                     : e.hasUniquePieces ? 31332 : 462;
+            } else if (k == order[1]) {
+                d->groupIdx[1] = idx;
+                idx *= tbBinomial[d->groupLen[1]][48 - d->groupLen[0]];
+            } else {
+                d->groupIdx[next] = idx;
+                idx *= tbBinomial[d->groupLen[next]][freeSquares];
+                freeSquares -= d->groupLen[next++];
+            }
+        }
+        d->groupIdx[n] = idx;
+    }
+    
+    static uint16_t leftSymbol(const PairsData* d, int sym) {
+        const uint8_t* lr = d->btree + 3 * sym;
+        return uint16_t(((lr[1] & 0xF) << 8) | lr[0]);
+    }
+    
+    static uint16_t rightSymbol(const PairsData* d, int sym) {
+        const uint8_t* lr = d->btree + 3 * sym;
+        return uint16_t((lr[2] << 4) | (lr[1] >> 4));
+    }
+    
+    // Number of values symbol s expands to, minus one. A symbol whose right
+    // half is 0xFFF is a leaf holding a single value.
+    static uint8_t setSymlen(PairsData* d, int s, std::vector<bool>& visited) {
+        visited[s] = true;
+        int right = rightSymbol(d, s);
+        if (right == 0xFFF) {
+            return 0;
+        }
+        int left = leftSymbol(d, s);
+        if (!visited[left]) {
+            d->symlen[left] = setSymlen(d, left, visited);
+        }
+        if (!visited[right]) {
+            d->symlen[right] = setSymlen(d, right, visited);
+        }
+        return uint8_t(d->symlen[left] + d->symlen[right] + 1);
+    }
+    
+    static const uint8_t* setSizes(PairsData* d, const uint8_t* data) {
+        d->flags = *data++;
+        
+        if (d->flags & TB_FLAG_SINGLE_VALUE) {
+            d->numBlocks = d->blockLengthSize = 0;
+            d->span = d->sparseIndexSize = 0;
+            d->minSymLen = *data++;  // The value of every position
+            return data;
+        }
+        
+        // The last group index is the number of positions in the table
+        uint64_t tableSize = d->groupIdx[std::find(d->groupLen, d->groupLen + TB_PIECES, 0) - d->groupLen];
+        
+        d->blockSize = size_t(1) << *data++;
+        d->span = size_t(1) << *data++;
+        d->sparseIndexSize = size_t((tableSize + d->span - 1) / d->span);
+        int padding = *data++;
+        d->numBlocks = uint32_t(tbReadLE(data, 4));
+        data += 4;
+        d->blockLengthSize = d->numBlocks + padding;
+        d->maxSymLen = *data++;
+        d->minSymLen = *data++;
+        d->lowestSym = data;
+        d->base64.assign(d->maxSymLen - d->minSymLen + 1, 0);
+        
+        // Canonical Huffman code: longer codes have lower values. Derive the
+        // lowest code of each length, left aligned in 64 bits, so that the
+        // length of the code at the front of a bit buffer is found by comparing
+        // the buffer against base64[] in order.
+        for (int i = int(d->base64.size()) - 2; i >= 0; i--) {
+            d->base64[i] = (d->base64[i + 1] + tbReadLE(d->lowestSym + 2 * i, 2)
+                            - tbReadLE(d->lowestSym + 2 * (i + 1), 2)) / 2;
+        }
+        for (size_t i = 0; i < d->base64.size(); i++) {
+            d->base64[i] <<= 64 - i - d->minSymLen;
+        }
+        
+        data += d->base64.size() * 2;
+        d->symlen.assign(size_t(tbReadLE(data, 2)), 0);
+        data += 2;
+        d->btree = data;
+        
+        std::vector<bool> visited(d->symlen.size());
+        for (size_t sym = 0; sym < d->symlen.size(); sym++) {
+            if (!visited[sym]) {
+                d->symlen[sym] = setSymlen(d, int(sym), visited);
+            }
+        }
+        
+        return data + d->symlen.size() * 3 + (d->symlen.size() & 1);
+    }
+    
+    // DTZ values are stored as ranks by frequency; the maps back to the real
+    // values follow the size headers
+    static const uint8_t* setDtzMap(TBTable& e, const uint8_t* data, int maxFile) {
+        e.dtzMap = data;
+        
+        for (int f = 0; f <= maxFile; f++) {
+            PairsData* d = e.get(0, f);
+            if (!(d->flags & TB_FLAG_MAPPED)) {
+                continue;
+            }
+            if (d->flags & TB_FLAG_WIDE) {
+                data += uintptr_t(data) & 1;  // uint16 aligned
+                for (int i = 0; i < 4; i++) {
+                    d->mapIdx[i] = uint16_t((data - e.dtzMap) / 2 + 1);
+                    data += 2 * tbReadLE(data, 2) + 2;
+                }
+            } else {
+                for (int i = 0; i < 4; i++) {
+                    d->mapIdx[i] = uint16_t(data - e.dtzMap + 1);
+                    data += *data + 1;
+                }
+            }
+        }
+        
+        return data + (uintptr_t(data) & 1);
+    }
+    
+    // Reads the headers of a freshly mapped file into the table's PairsData
+    static void setup(TBTable& e, const uint8_t* data) {
+        data++;  // Flags, already known from the name
+        
+        int sides = e.type == TB_WDL && e.key != e.key2 ? 2 : 1;
+        int maxFile = e.hasPawns ? 3 : 0;
+        bool pawnsOnBothSides = e.hasPawns && e.pawnCount[1];
+        
+        for (int f = 0; f <= maxFile; f++) {
+            for (int i = 0; i < sides; i++) {
+                *e.get(i, f) = PairsData();
+            }
+            
+            int order[2][2] = {
+                { *data & 0xF, pawnsOnBothSides ? *(data + 1) & 0xF : 0xF },
+                { *data >> 4, pawnsOnBothSides ? *(data + 1) >> 4 : 0xF }
+            };
+            data += 1 + pawnsOnBothSides;
+            
+            for (int k = 0; k < e.pieceCount; k++, data++) {
+                for (int i = 0; i < sides; i++) {
+                    e.get(i, f)->pieces[k] = i ? *data >> 4 : *data & 0xF;
+                }
+            }
+            for (int i = 0; i < sides; i++) {
+                setGroups(e, e.get(i, f), order[i], f);
+            }
+        }
+        
+        data += uintptr_t(data) & 1;
+        
+        for (int f = 0; f <= maxFile; f++) {
+            for (int i = 0; i < sides; i++) {
+                data = setSizes(e.get(i, f), data);
+            }
+        }
+        
+        if (e.type == TB_DTZ) {
+            data = setDtzMap(e, data, maxFile);
+        }
+        
+        for (int f = 0; f <= maxFile; f++) {
+            for (int i = 0; i < sides; i++) {
+                PairsData* d = e.get(i, f);
+                d->sparseIndex = data;
+                data += d->sparseIndexSize * 6;
+            }
+        }
+        for (int f = 0; f <= maxFile; f++) {
+            for (int i = 0; i < sides; i++) {
+                PairsData* d = e.get(i, f);
+                d->blockLength = data;
+                data += size_t(d->blockLengthSize) * 2;
+            }
+        }
+        for (int f = 0; f <= maxFile; f++) {
+            for (int i = 0; i < sides; i++) {
+                PairsData* d = e.get(i, f);
+                data = reinterpret_cast<const uint8_t*>((uintptr_t(data) + 63) & ~uintptr_t(63));
+                d->data = data;
+                data += size_t(d->numBlocks) * d->blockSize;
+            }
+        }
+    }
+    
+    // Maps the table's file on first use. Safe to call from several search
+    // threads at once; returns false if the file is missing or corrupt.
+    bool mapped(TBTable& e) {
+        if (e.ready.load(std::memory_order_acquire)) {
+            return e.file.data() != nullptr;
+        }
+        
+        std::lock_guard<std::mutex> lock(mapMutex);
+        if (e.ready.load(std::memory_order_relaxed)) {
+            return e.file.data() != nullptr;
+        }
+        
+        static const uint8_t MAGIC[2][4] = { { 0xD7, 0x66, 0x0C, 0xA5 }, { 0x71, 0xE8, 0x23, 0x5D } };
+        std::string path;
+        if (fileExists(e.name + (e.type == TB_WDL ? ".rtbw" : ".rtbz"), path) && e.file.open(path)) {
+            if (e.file.size() > 4 && std::memcmp(e.file.data(), MAGIC[e.type == TB_WDL], 4) == 0) {
+                setup(e, reinterpret_cast<const uint8_t*>(e.file.data()) + 4);
+            } else {
+                e.file.close();
+            }
+        }
+        
+        e.ready.store(true, std::memory_order_release);
+        return e.file.data() != nullptr;
+    }
+    
+    // Decodes the value with the given index
+    static int decompressPairs(const PairsData* d, uint64_t idx) {
+        if (d->flags & TB_FLAG_SINGLE_VALUE) {
+            return d->minSymLen;
+        }
+        
+        // Block n holds blockLength[n] + 1 values. Sparse index entry k gives
+        // the block and offset of value k * span + span / 2; walk from there
+        // to the block that holds idx.
+        uint32_t k = uint32_t(idx / d->span);
+        uint32_t block = uint32_t(tbReadLE(d->sparseIndex + 6 * size_t(k), 4));
+        int offset = int(tbReadLE(d->sparseIndex + 6 * size_t(k) + 4, 2));
+        offset += int(idx % d->span) - int(d->span / 2);
+        
+        while (offset < 0) {
+            offset += int(tbReadLE(d->blockLength + 2 * size_t(--block), 2)) + 1;
+        }
+        while (offset > int(tbReadLE(d->blockLength + 2 * size_t(block), 2))) {
+            offset -= int(tbReadLE(d->blockLength + 2 * size_t(block++), 2)) + 1;
+        }
+        
+        // Read symbols from the start of the block until the one that covers
+        // the offset
+        const uint8_t* ptr = d->data + size_t(block) * d->blockSize;
+        uint64_t buf64 = tbReadBE(ptr, 8);
+        ptr += 8;
+        int buf64Size = 64;
+        int sym;
+        
+        while (true) {
+            int len = 0;  // Code length minus minSymLen
+            while (buf64 < d->base64[len]) {
+                len++;
+            }
+            sym = int((buf64 - d->base64[len]) >> (64 - len - d->minSymLen));
+            sym += int(tbReadLE(d->lowestSym + 2 * len, 2));
+            
+            if (offset < d->symlen[sym] + 1) {
+                break;
+            }
+            offset -= d->symlen[sym] + 1;
+            len += d->minSymLen;
+            buf64 <<= len;
+            buf64Size -= len;
+            if (buf64Size <= 32) {
+                buf64Size += 32;
+                buf64 |= tbReadBE(ptr, 4) << (64 - buf64Size);
+                ptr += 4;
+            }
+        }
+        
+        // Expand the symbol's pairs down to the single value at the offset
+        while (d->symlen[sym]) {
+            int left = leftSymbol(d, sym);
+            if (offset < d->symlen[left] + 1) {
+                sym = left;
+            } else {
+                offset -= d->symlen[left] + 1;
+                sym = rightSymbol(d, sym);
+            }
+        }
+        return leftSymbol(d, sym);
+    }
+    
+    // Converts a stored DTZ rank back to plies to zeroing
+    static int mapDtzScore(TBTable& e, int file, int value, int wdl) {
+        static const int WDL_MAP[5] = { 1, 3, 0, 2, 0 };
+        const PairsData* d = e.get(0, file);
+        
+        if (d->flags & TB_FLAG_MAPPED) {
+            int index = d->mapIdx[WDL_MAP[wdl + 2]] + value;
+            value = (d->flags & TB_FLAG_WIDE) ? int(tbReadLE(e.dtzMap + 2 * index, 2)) : e.dtzMap[index];
+        }
+        
+        // Some values are stored in moves rather than plies
+        if ((wdl == WDL_WIN && !(d->flags & TB_FLAG_WIN_PLIES))
+            || (wdl == WDL_LOSS && !(d->flags & TB_FLAG_LOSS_PLIES))
+            || wdl == WDL_CURSED_WIN || wdl == WDL_BLESSED_LOSS) {
+            value *= 2;
+        }
+        return value + 1;
+    }
+    
+    // Computes the position's index in the table and decodes its value
+    int probeIndex(TBTable& e, const Bitboard* pieceBB, bool whiteToMove, int wdl, TBProbeState& state) {
+        int squares[TB_PIECES];
+        int pieces[TB_PIECES];
+        int size = 0;
+        int leadPawnCount = 0;
+        Bitboard leadPawns = 0;
+        int tbFile = 0;
+        
+        int counts[2][7];
+        for (int type = 1; type <= 6; type++) {
+            counts[0][type] = popCount(pieceBB[type]);
+            counts[1][type] = popCount(pieceBB[type + 6]);
+        }
+        
+        // Tables are stored with the stronger side (the one of the file name's
+        // first half) as white, and symmetric ones with white to move only.
+        // Otherwise the colors are swapped and the board flipped vertically.
+        bool symmetricBlackToMove = e.key == e.key2 && !whiteToMove;
+        bool blackStronger = tbMaterialKey(counts, false) != e.key;
+        bool flip = symmetricBlackToMove || blackStronger;
+        int flipColor = flip ? 8 : 0;
+        int flipSquares = flip ? 56 : 0;
+        int stm = int(flip) ^ int(!whiteToMove);
+        
+        // Tables with pawns are split by the file of the leading pawn: the one
+        // with the highest tbMapPawns value, i.e. nearest the edge
+        if (e.hasPawns) {
+            int pawn = e.get(0, 0)->pieces[0] ^ flipColor;
+            Bitboard b = leadPawns = pieceBB[pawn == 1 ? 1 : 7];
+            while (b) {
+                squares[size++] = popLsb(b) ^ flipSquares;
+            }
+            leadPawnCount = size;
+            std::swap(squares[0], *std::max_element(squares, squares + leadPawnCount,
+                [](int a, int b) { return tbMapPawns[a] < tbMapPawns[b]; }));
+            tbFile = std::min(squares[0] & 7, 7 - (squares[0] & 7));
+        }
+        
+        if (e.type == TB_DTZ && (e.get(stm, tbFile)->flags & TB_FLAG_STM) != stm
+            && !(e.key == e.key2 && !e.hasPawns)) {
+            state = TB_CHANGE_STM;
+            return 0;
+        }
+        
+        // Table piece codes are 1-6 for white and 9-14 for black
+        for (int piece = 1; piece <= 12; piece++) {
+            Bitboard b = pieceBB[piece] & ~leadPawns;
+            while (b) {
+                squares[size] = popLsb(b) ^ flipSquares;
+                pieces[size++] = (piece <= 6 ? piece : piece + 2) ^ flipColor;
+            }
+        }
+        
+        PairsData* d = e.get(stm, tbFile);
+        
+        // Put the pieces in the table's order
+        for (int i = leadPawnCount; i < size - 1; i++) {
+            for (int j = i + 1; j < size; j++) {
+                if (d->pieces[i] == pieces[j]) {
+                    std::swap(pieces[i], pieces[j]);
+                    std::swap(squares[i], squares[j]);
+                    break;
+                }
+            }
+        }
+        
+        // Mirror so that the leading piece is on files a-d
+        if ((squares[0] & 7) > 3) {
+            for (int i = 0; i < size; i++) {
+                squares[i] ^= 7;
+            }
+        }
+        
+        uint64_t idx;
+        if (e.hasPawns) {
+            idx = tbLeadPawnIdx[leadPawnCount][squares[0]];
+            std::stable_sort(squares + 1, squares + leadPawnCount,
+                [](int a, int b) { return tbMapPawns[a] < tbMapPawns[b]; });
+            for (int i = 1; i < leadPawnCount; i++) {
+                idx += tbBinomial[i][tbMapPawns[squares[i]]];
+            }
+        } else {
+            // Without pawns, also mirror the leading piece to ranks 1-4 and
+            // then below the a1-h8 diagonal
+            if ((squares[0] >> 3) > 3) {
+                for (int i = 0; i < size; i++) {
+                    squares[i] ^= 56;
+                }
+            }
+            for (int i = 0; i < d->groupLen[0]; i++) {
+                if (!tbOffA1H8(squares[i])) {
+                    continue;
+                }
+                if (tbOffA1H8(squares[i]) > 0) {
+                    for (int j = i; j < size; j++) {
+                        squares[j] = ((squares[j] >> 3) | (squares[j] << 3)) & 63;
+                    }
+                }
+                break;
+            }
+            
+            if (e.hasUniquePieces) {
+                // Three unique pieces are encoded together, skipping the
+                // squares taken by the earlier ones
+                int adjust1 = squares[1] > squares[0];
+                int adjust2 = (squares[2] > squares[0]) + (squares[2] > squares[1]);
+                
+                if (tbOffA1H8(squares[0])) {
+                    idx = (tbMapA1D1D4[squares[0]] * 63 + (squares[1] - adjust1)) * 62
+                        + squares[2] - adjust2;
+                } else if (tbOffA1H8(squares[1])) {
+                    idx = (6 * 63 + (squares[0] >> 3) * 28 + tbMapB1H1H7[squares[1]]) * 62
+                        + squares[2] - adjust2;
+                } else if (tbOffA1H8(squares[2])) {
+                    idx = 6 * 63 * 62 + 4 * 28 * 62
+                        + (squares[0] >> 3) * 7 * 28
+                        + ((squares[1] >> 3) - adjust1) * 28
+                        + tbMapB1H1H7[squares[2]];
+                } else {
+                    idx = 6 * 63 * 62 + 4 * 28 * 62 + 4 * 7 * 28
+                        + (squares[0] >> 3) * 7 * 6
+                        + ((squares[1] >> 3) - adjust1) * 6
+                        + ((squares[2] >> 3) - adjust2);
+                }
+            } else {
+                idx = tbMapKK[tbMapA1D1D4[squares[0]]][squares[1]];
+            }
+        }
+        
+        // The remaining groups, each as a combination of the squares left free
+        // by the earlier groups (the other side's pawns cannot use ranks 1 and 8)
+        idx *= d->groupIdx[0];
+        int* groupSq = squares + d->groupLen[0];
+        bool remainingPawns = e.hasPawns && e.pawnCount[1];
+        
+        for (int next = 1; d->groupLen[next]; next++) {
+            std::stable_sort(groupSq, groupSq + d->groupLen[next]);
+            uint64_t n = 0;
+            for (int i = 0; i < d->groupLen[next]; i++) {
+                int adjust = int(std::count_if(squares, groupSq, [&](int sq) { return groupSq[i] > sq; }));
+                n += tbBinomial[i + 1][groupSq[i] - adjust - 8 * remainingPawns];
+            }
+            remainingPawns = false;
+            idx += n * d->groupIdx[next];
+            groupSq += d->groupLen[next];
+        }
+        
+        int value = decompressPairs(d, idx);
+        return e.type == TB_WDL ? value - 2 : mapDtzScore(e, tbFile, value, wdl);
+    }
+    
+public:
+    // Looks for table files in the given directories (separated by ':', or
+    // ';' on Windows) and returns how many tables were found. An empty path
+    // disables probing.
+    int init(const std::string& pathList) {
+        initTablebaseTables();
+        byKey.clear();
+        entries.clear();
+        paths.clear();
+        largest = 0;
+        
+        if (pathList.empty() || pathList == "<empty>") {
+            return 0;
+        }
+
+#if defined(_WIN32)
+        const char separator = ';';
+#else
+        const char separator = ':';
+#endif
+        std::istringstream stream(pathList);
+        std::string dir;
+        while (std::getline(stream, dir, separator)) {
+            if (!dir.empty()) {
+                paths.push_back(dir);
+            }
+        }
+        
+        // Every material combination of up to 7 pieces, written like the file
+        // names: strongest side first, pieces from king to pawn
+        const std::string P = " PNBRQK";
+        for (int p1 = 1; p1 <= 5; p1++) {
+            add(std::string("K") + P[p1] + "vK");
+            
+            for (int p2 = 1; p2 <= p1; p2++) {
+                add(std::string("K") + P[p1] + P[p2] + "vK");
+                add(std::string("K") + P[p1] + "vK" + P[p2]);
+                
+                for (int p3 = 1; p3 <= 5; p3++) {
+                    add(std::string("K") + P[p1] + P[p2] + "vK" + P[p3]);
+                }
+                
+                for (int p3 = 1; p3 <= p2; p3++) {
+                    add(std::string("K") + P[p1] + P[p2] + P[p3] + "vK");
+                    
+                    for (int p4 = 1; p4 <= p3; p4++) {
+                        add(std::string("K") + P[p1] + P[p2] + P[p3] + P[p4] + "vK");
+                        for (int p5 = 1; p5 <= p4; p5++) {
+                            add(std::string("K") + P[p1] + P[p2] + P[p3] + P[p4] + P[p5] + "vK");
+                        }
+                        for (int p5 = 1; p5 <= 5; p5++) {
+                            add(std::string("K") + P[p1] + P[p2] + P[p3] + P[p4] + "vK" + P[p5]);
+                        }
+                    }
+                    
+                    for (int p4 = 1; p4 <= 5; p4++) {
+                        add(std::string("K") + P[p1] + P[p2] + P[p3] + "vK" + P[p4]);
+                        for (int p5 = 1; p5 <= p4; p5++) {
+                            add(std::string("K") + P[p1] + P[p2] + P[p3] + "vK" + P[p4] + P[p5]);
+                        }
+                    }
+                }
+                
+                for (int p3 = 1; p3 <= p1; p3++) {
+                    for (int p4 = 1; p4 <= (p1 == p3 ? p2 : p3); p4++) {
+                        add(std::string("K") + P[p1] + P[p2] + "vK" + P[p3] + P[p4]);
+                    }
+                }
+            }
+        }
+        
+        return int(entries.size());
+    }
+    
+    // Most pieces (kings included) of any table found, 0 when there are none
+    int maxPieces() const {
+        return largest;
+    }
+    
+    // Probes the WDL or DTZ table of a position given by its piece bitboards
+    // (indexed by piece code). This is the raw table value: the caller has to
+    // resolve the positions the generator stores as "don't care", see
+    // ChessEngine::tablebaseSearch(). For DTZ, wdl is the position's WDL value.
+    int probeTable(TBType type, const Bitboard* pieceBB, bool whiteToMove, int wdl, TBProbeState& state) {
+        Bitboard all = 0;
+        for (int piece = 1; piece <= 12; piece++) {
+            all |= pieceBB[piece];
+        }
+        if (popCount(all) == 2) {
+            return WDL_DRAW;  // Bare kings
+        }
+        
+        int counts[2][7];
+        for (int t = 1; t <= 6; t++) {
+            counts[0][t] = popCount(pieceBB[t]);
+            counts[1][t] = popCount(pieceBB[t + 6]);
+        }
+        auto it = byKey.find(tbMaterialKey(counts, false));
+        if (it == byKey.end()) {
+            state = TB_FAIL;
+            return 0;
+        }
+        
+        TBTable& table = type == TB_WDL ? it->second->wdl : it->second->dtz;
+        if (!mapped(table)) {
+            state = TB_FAIL;
+            return 0;
+        }
+        return probeIndex(table, pieceBB, whiteToMove, wdl, state);
+    }
+};
+
+// Shared by every engine and thread in the process
+SyzygyTablebases tablebases;
+
+// Deepest search the fixed-size per-engine stacks are sized for, and the number
+// of game moves (from "position ... moves") kept on the undo stack below it.
+const int MAX_PLY = 128;
+const int MAX_GAME_PLY = 1024;
+
+// Depth searched by a "go" without limits and used by "bench" unless told otherwise
+const int DEFAULT_SEARCH_DEPTH = 6;
+
+// Score bounds. Mate scores are MATE_SCORE minus the distance to mate in plies;
+// every score fits in 16 bits so it can be stored in the transposition table.
+const int INF_SCORE = 32001;
+const int MATE_SCORE = 32000;
+
+// Tablebase wins and losses score below every mate but above any evaluation
+const int TB_WIN_SCORE = MATE_SCORE - 2 * MAX_PLY;
+
+// Transposition table size in megabytes until "setoption name Hash" changes it
+const int DEFAULT_HASH_MB = 16;
+const int MAX_HASH_MB = 65536;
+
+// Time kept back from every move for GUI and communication lag (milliseconds)
+const int64_t MOVE_OVERHEAD = 30;
+
+// Limits given to "go". Zero means the limit was not given.
+struct SearchLimits {
+    int64_t time[2] = { 0, 0 };  // wtime / btime in milliseconds
+    int64_t inc[2] = { 0, 0 };   // winc / binc in milliseconds
+    int movesToGo = 0;
+    int64_t moveTime = 0;
+    int depth = 0;
+    uint64_t nodes = 0;
+    bool infinite = false;  // Search until "stop"
+    bool ponder = false;    // Search on the opponent's time until "ponderhit" or "stop"
+};
+
+// Selective search techniques, each switchable with a UCI option so its effect
+// on time-to-depth and strength can be measured on its own. Changed only
+// between searches.
+struct SearchOptions {
+    bool nullMovePruning = true;
+    bool lateMoveReductions = true;
+    bool reverseFutilityPruning = true;
+    bool futilityPruning = true;
+    bool checkExtensions = true;
+};
+
+SearchOptions searchOptions;
+
+// Shared by the threads of one search and by the UCI loop, which stops the
+// search or ends pondering through it while the search runs
+struct SearchControl {
+    std::atomic<bool> stop{false};
+    std::atomic<bool> pondering{false};  // Time limits do not apply while set
+    std::atomic<uint64_t> nodes{0};      // All threads, added in batches of 2048
+    
+    // Receives UCI "info" lines while searching; no reports when empty
+    std::function<void(const std::string&)> report;
+};
+
+// The search thread reports while the UCI loop answers commands, so output
+// from both is written a whole line at a time under this lock
+std::mutex outputMutex;
+
+void sendLine(const std::string& line) {
+    std::lock_guard<std::mutex> lock(outputMutex);
+    std::cout << line << std::endl;
+}
+
+// Search counters, compiled in with -DSEARCH_STATS. The phase timers read the
+// clock around every move generation and evaluation, which slows the search
+// down noticeably, so normal builds leave all of it out.
+#if defined(SEARCH_STATS)
+#define STATS(statement) statement
+
+// Formats part / total as a percentage with one decimal
+std::string statsPercent(uint64_t part, uint64_t total) {
+    uint64_t perMille = part * 1000 / std::max<uint64_t>(total, 1);
+    return std::to_string(perMille / 10) + "." + std::to_string(perMille % 10) + "%";
+}
+
+struct SearchStats {
+    uint64_t ttProbes = 0;
+    uint64_t ttHits = 0;
+    uint64_t cutoffs = 0;
+    uint64_t firstMoveCutoffs = 0;  // Beta cutoffs on the first move searched
+    uint64_t qsearchNodes = 0;
+    uint64_t searchNanos = 0;       // Summed over all search threads
+    uint64_t movegenNanos = 0;
+    uint64_t evalNanos = 0;
+    
+    void add(const SearchStats& other) {
+        ttProbes += other.ttProbes;
+        ttHits += other.ttHits;
+        cutoffs += other.cutoffs;
+        firstMoveCutoffs += other.firstMoveCutoffs;
+        qsearchNodes += other.qsearchNodes;
+        searchNanos += other.searchNanos;
+        movegenNanos += other.movegenNanos;
+        evalNanos += other.evalNanos;
+    }
+    
+    // One line per counter, for a search that visited nodes positions
+    std::vector<std::string> summary(uint64_t nodes) const {
+        return {
+            "TT hit rate " + statsPercent(ttHits, ttProbes) + " of " + std::to_string(ttProbes) + " probes",
+            "First move cutoffs " + statsPercent(firstMoveCutoffs, cutoffs) + " of " + std::to_string(cutoffs) + " cutoffs",
+            "Quiescence nodes " + statsPercent(qsearchNodes, nodes) + " of " + std::to_string(nodes) + " nodes",
+            "Move generation " + statsPercent(movegenNanos, searchNanos) + ", evaluation "
+                + statsPercent(evalNanos, searchNanos) + " of " + std::to_string(searchNanos / 1000000) + " ms search time",
+        };
+    }
+};
+
+// Adds the time until it goes out of scope to a nanosecond total
+class StatsTimer {
+    uint64_t& total;
+    std::chrono::steady_clock::time_point start;
+    
+public:
+    explicit StatsTimer(uint64_t& total) : total(total), start(std::chrono::steady_clock::now()) {}
+    
+    ~StatsTimer() {
+        total += std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+    }
+};
+#else
+#define STATS(statement)
+#endif
+
+// Lazy SMP depth skipping: helper thread i searches depth d only when
+// ((d + SKIP_PHASE[i % 20]) / SKIP_SIZE[i % 20]) is even.
+const int SKIP_SIZE[20] = { 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 4, 4, 4, 4, 4, 4, 4, 4 };
+const int SKIP_PHASE[20] = { 0, 1, 0, 1, 2, 3, 0, 1, 2, 3, 4, 5, 0, 1, 2, 3, 4, 5, 6, 7 };
+
+const int MAX_THREADS = 512;
+
+// Moves are packed into 16 bits:
+//   bits 0-5    from square
+//   bits 6-11   to square
+//   bits 12-13  promotion piece type minus 2 (knight, bishop, rook, queen)
+//   bits 14-15  move kind (see below)
+enum MoveKind {
+    NORMAL = 0,
+    PROMOTION = 1,
+    EN_PASSANT = 2,
+    CASTLING = 3
+};
+
+struct Move {
+    uint16_t data;
+    
+    Move() = default;
+    explicit Move(int from, int to, int kind = NORMAL, int promotionType = 2)
+        : data(uint16_t(from | (to << 6) | ((promotionType - 2) << 12) | (kind << 14))) {}
+    
+    int from() const { return data & 63; }
+    int to() const { return (data >> 6) & 63; }
+    int kind() const { return data >> 14; }
+    int promotionType() const { return ((data >> 12) & 3) + 2; }  // 2 = knight .. 5 = queen
+    
+    bool operator==(Move other) const { return data == other.data; }
+    bool operator!=(Move other) const { return data != other.data; }
+};
+
+// a1a1 can never be generated, so the all-zero move doubles as "no move"
+const Move NO_MOVE = Move(0, 0);
+
+// Fixed-capacity move list that lives on the stack. 256 comfortably exceeds the
+// maximum number of moves in any reachable chess position (218).
+struct MoveList {
+    Move moves[256];
+    int count = 0;
+    
+    void add(Move move) { moves[count++] = move; }
+    void clear() { count = 0; }
+    int size() const { return count; }
+    bool empty() const { return count == 0; }
+    
+    Move& operator[](int i) { return moves[i]; }
+    Move operator[](int i) const { return moves[i]; }
+    Move* begin() { return moves; }
+    Move* end() { return moves + count; }
+};
+
+// Outcome of one thread's search
+struct SearchResult {
+    Move bestMove = NO_MOVE;
+    int score = 0;
+    int depth = 0;  // Deepest completed iteration
+    Move pv[MAX_PLY];  // Principal variation, starting with bestMove
+    int pvLength = 0;
+};
+
+// Formats a score for a UCI info line: centipawns, or moves to mate
+std::string scoreToUci(int score) {
+    if (score >= MATE_SCORE - MAX_PLY) {
+        return "mate " + std::to_string((MATE_SCORE - score + 1) / 2);
+    }
+    if (score <= -MATE_SCORE + MAX_PLY) {
+        return "mate " + std::to_string(-(MATE_SCORE + score) / 2);
+    }
+    return "cp " + std::to_string(score);
+}
+
+// Side to move. The move generator, makeMove and the search take it as a
+// template parameter, so their color-dependent squares, directions and piece
+// codes are constants in each instantiation.
+enum Color {
+    WHITE,
+    BLACK
+};
+
+constexpr Color operator~(Color color) {
+    return Color(color ^ 1);
+}
+
+// What a generator call produces. Captures include en passant and every
+// promotion, so the captures and quiets of a position together are all its moves.
+enum GenType {
+    GEN_CAPTURES,
+    GEN_QUIETS,
+    GEN_ALL
+};
+
+// Piece values used by the static exchange evaluator, indexed by piece code
+const int SEE_VALUES[13] = { 0, 100, 320, 330, 500, 900, 20000, 100, 320, 330, 500, 900, 20000 };
+
+// Quiescence delta pruning: a capture is skipped when even winning the captured
+// piece plus this margin would leave the score below alpha
+const int DELTA_MARGIN = 200;
+
+// Reverse futility pruning: at depth <= RFP_MAX_DEPTH a node whose static
+// evaluation beats beta by RFP_MARGIN per ply of depth is cut off
+const int RFP_MAX_DEPTH = 6;
+const int RFP_MARGIN = 80;
+
+// Futility pruning: at depth <= FUTILITY_MAX_DEPTH quiet moves are skipped when
+// the static evaluation plus FUTILITY_MARGIN per ply of depth is below alpha
+const int FUTILITY_MAX_DEPTH = 3;
+const int FUTILITY_MARGIN = 120;
+
+// Null move pruning searches depth - 1 - (NULL_MOVE_REDUCTION + depth / 4)
+// after the null move. From NULL_MOVE_VERIFY_DEPTH on a fail high is only
+// trusted after a reduced search of the node itself without null moves also
+// fails high, which catches zugzwang.
+const int NULL_MOVE_REDUCTION = 3;
+const int NULL_MOVE_VERIFY_DEPTH = 12;
+
+// Late move reductions apply from LMR_MIN_DEPTH on, to quiet moves after the
+// first LMR_MIN_MOVES, by lmrReductions[depth][move number] plies
+const int LMR_MIN_DEPTH = 3;
+const int LMR_MIN_MOVES = 3;
+int lmrReductions[64][64];
+
+void initSearchTables() {
+    static std::once_flag initialized;
+    
+    std::call_once(initialized, [] {
+        for (int depth = 0; depth < 64; depth++) {
+            for (int moveNumber = 0; moveNumber < 64; moveNumber++) {
+                lmrReductions[depth][moveNumber] = (depth == 0 || moveNumber == 0) ? 0
+                    : int(0.75 + std::log(depth) * std::log(moveNumber) / 2.25);
+            }
+        }
+    });
+}
+
+// History scores stay within [-MAX_HISTORY, MAX_HISTORY]
+const int MAX_HISTORY = 16384;
+
+// State destroyed by makeMove that unmakeMove cannot recompute from the move
+struct UndoInfo {
+    int movedPiece;       // Piece code that moved (before promotion)
+    int capturedPiece;    // 0 when the move was not a capture
+    int capturedSquare;   // Differs from the target square for en passant
+    int castlingFlags;    // Packed king/rook moved flags, see castlingFlags()
+    int enPassantCol;
+    uint64_t key;         // Zobrist key before the move
+    Bitboard checkers;    // Check information before the move
+    Bitboard pinned;
+    int halfmoveClock;
+    int pliesFromNull;
+};
+
+// -------------------------
+// Transposition table
+// -------------------------
+enum Bound {
+    BOUND_NONE = 0,
+    BOUND_UPPER = 1,  // Score is at most the stored value (failed low)
+    BOUND_LOWER = 2,  // Score is at least the stored value (failed high)
+    BOUND_EXACT = 3
+};
+
+// Result of a successful probe
+struct TTData {
+    Move move;
+    int score;
+    int depth;
+    int bound;
+};
+
+// An entry is two 64-bit words stored as (key ^ data, data). A reader accepts
+// the entry only if the XOR of both words gives back its key, so an entry torn
+// by concurrent writers simply misses instead of returning another position's
+// data, and no locks are needed (Hyatt's lockless hashing).
+//
+// data layout:
+//   bits 0-15   best move
+//   bits 16-31  score (signed)
+//   bits 32-39  depth
+//   bits 40-41  bound
+//   bits 42-49  generation of the search that wrote it
+struct TTEntry {
+    std::atomic<uint64_t> keyXorData;
+    std::atomic<uint64_t> data;
+};
+
+// Four entries fill one 64-byte cache line, so a probe costs one memory access
+struct alignas(64) TTBucket {
+    TTEntry entries[4];
+};
+
+class TranspositionTable {
+    TTBucket* buckets = nullptr;
+    uint64_t bucketCount = 0;
+    size_t allocatedBytes = 0;
+    std::atomic<uint8_t> generation{0};  // EPD workers start searches concurrently
+    
+    static uint64_t packData(Move move, int score, int depth, int bound, int generation) {
+        return uint64_t(move.data)
+             | (uint64_t(uint16_t(int16_t(score))) << 16)
+             | (uint64_t(uint8_t(depth)) << 32)
+             | (uint64_t(bound) << 40)
+             | (uint64_t(generation) << 42);
+    }
+    
+    static int dataDepth(uint64_t data) { return int((data >> 32) & 0xFF); }
+    static int dataGeneration(uint64_t data) { return int((data >> 42) & 0xFF); }
+    
+    TTBucket& bucketFor(uint64_t key) const {
+        // Maps the upper key bits onto [0, bucketCount) without a division
+        return buckets[((key >> 32) * bucketCount) >> 32];
+    }
+    
+    // Large tables are aligned to 2 MB and, on Linux, flagged for transparent
+    // huge pages, which cuts TLB misses on the random accesses of a probe.
+    static void* allocateLarge(size_t bytes) {
+#if defined(__linux__)
+        const size_t alignment = size_t(2) << 20;
+        bytes = (bytes + alignment - 1) / alignment * alignment;
+        void* mem = std::aligned_alloc(alignment, bytes);
+        if (mem) {
+            madvise(mem, bytes, MADV_HUGEPAGE);
+        }
+        return mem;
+#elif defined(_WIN32)
+        return _aligned_malloc(bytes, 64);
+#else
+        return std::aligned_alloc(64, (bytes + 63) / 64 * 64);
+#endif
+    }
+    
+    static void freeLarge(void* mem) {
+#if defined(_WIN32)
+        _aligned_free(mem);
+#else
+        std::free(mem);
+#endif
+    }
+    
+public:
+    TranspositionTable() {
+        resize(DEFAULT_HASH_MB);
+    }
+    
+    ~TranspositionTable() {
+        freeLarge(buckets);
+    }
+    
+    TranspositionTable(const TranspositionTable&) = delete;
+    TranspositionTable& operator=(const TranspositionTable&) = delete;
+    
+    // Reallocates the table with the given size in megabytes, clearing it
+    void resize(size_t megabytes) {
+        freeLarge(buckets);
+        
+        bucketCount = std::max<uint64_t>(1, (uint64_t(megabytes) << 20) / sizeof(TTBucket));
+        allocatedBytes = bucketCount * sizeof(TTBucket);
+        buckets = static_cast<TTBucket*>(allocateLarge(allocatedBytes));
+        if (!buckets) {
+            std::cerr << "Failed to allocate " << megabytes << " MB for the hash table" << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        clear();
+    }
+    
+    void clear() {
+        std::memset(static_cast<void*>(buckets), 0, allocatedBytes);
+        generation = 0;
+    }
+    
+    // Called once per search so entries from older searches are replaced first
+    void newSearch() {
+        generation++;
+    }
+    
+    // Per mille of the table filled by the current search, sampled from the
+    // first thousand entries, for the UCI "hashfull" field
+    int hashfull() const {
+        uint64_t sampled = std::min<uint64_t>(bucketCount, 250);
+        int current = generation.load(std::memory_order_relaxed);
+        uint64_t used = 0;
+        for (uint64_t i = 0; i < sampled; i++) {
+            for (const TTEntry& entry : buckets[i].entries) {
+                uint64_t data = entry.data.load(std::memory_order_relaxed);
+                used += data != 0 && dataGeneration(data) == current;
+            }
+        }
+        return sampled ? int(used * 1000 / (sampled * 4)) : 0;
+    }
+    
+    bool probe(uint64_t key, TTData& result) const {
+        const TTBucket& bucket = bucketFor(key);
+        
+        for (const TTEntry& entry : bucket.entries) {
+            uint64_t data = entry.data.load(std::memory_order_relaxed);
+            if ((entry.keyXorData.load(std::memory_order_relaxed) ^ data) == key && data != 0) {
+                result.move.data = uint16_t(data);
+                result.score = int16_t(uint16_t(data >> 16));
+                result.depth = dataDepth(data);
+                result.bound = int((data >> 40) & 3);
+                return true;
+            }
+        }
+        return false;
+    }
+    
+    // Stores into the entry already holding this position if there is one,
+    // otherwise over the shallowest entry, treating older searches as shallower.
+    void store(uint64_t key, Move move, int score, int depth, int bound) {
+        TTBucket& bucket = bucketFor(key);
+        TTEntry* replace = &bucket.entries[0];
+        int replaceWorth = INT32_MAX;
+        
+        for (TTEntry& entry : bucket.entries) {
+            uint64_t data = entry.data.load(std::memory_order_relaxed);
+            
+            if ((entry.keyXorData.load(std::memory_order_relaxed) ^ data) == key) {
+                // Keep the old best move when this search did not find one
+                if (move == NO_MOVE) {
+                    move.data = uint16_t(data);
+                }
+                replace = &entry;
+                break;
+            }
+            
+            int age = uint8_t(generation.load(std::memory_order_relaxed) - dataGeneration(data));
+            int worth = dataDepth(data) - 8 * age;
+            if (worth < replaceWorth) {
+                replaceWorth = worth;
+                replace = &entry;
+            }
+        }
+        
+        uint64_t data = packData(move, score, std::max(depth, 0), bound,
+                                 generation.load(std::memory_order_relaxed));
+        replace->keyXorData.store(key ^ data, std::memory_order_relaxed);
+        replace->data.store(data, std::memory_order_relaxed);
+    }
+};
+
+// Shared by every search in the process, except those of engines given a
+// table of their own (see ChessEngine::setTranspositionTable)
+TranspositionTable transpositionTable;
+
+// Mate and tablebase scores are stored relative to the node rather than the
+// root, so an entry stays correct when the same position is reached at a
+// different ply.
+inline int scoreToTT(int score, int ply) {
+    if (score >= TB_WIN_SCORE - MAX_PLY) return score + ply;
+    if (score <= -TB_WIN_SCORE + MAX_PLY) return score - ply;
+    return score;
+}
+
+inline int scoreFromTT(int score, int ply) {
+    if (score >= TB_WIN_SCORE - MAX_PLY) return score - ply;
+    if (score <= -TB_WIN_SCORE + MAX_PLY) return score + ply;
+    return score;
+}
+
+// Self-play plays games on a pool of worker threads, one engine per worker,
+// and streams the positions to a training data file. Each game starts with
+// random moves from the engine's generator, seeded by the game number, and
+// continues with fixed-node searches until it is decided.
+//
+// Each position is a TRAINING_RECORD_SIZE byte little-endian record:
+//   bytes  0-7   occupied squares (bit n = square n, a1 = 0, h8 = 63)
+//   bytes  8-23  piece code (1-12, as in the mailbox) of each occupied square
+//                in square order, two per byte, low nibble first
+//   bytes 24-25  search score (int16), side to move's point of view
+//   bytes 26-27  best move (16-bit Move encoding)
+//   byte  28     game result for white: 0 loss, 1 draw, 2 win
+//   byte  29     bit 0 black to move, bits 1-4 castling rights (K, Q, k, q)
+//   byte  30     en passant file, 0xFF for none
+//   byte  31     50-move counter, capped at 255
+const int TRAINING_RECORD_SIZE = 32;
+const int TRAINING_RESULT_OFFSET = 28;
+
+// Games still undecided after this many plies are counted as draws
+const int SELFPLAY_MAX_PLIES = 400;
+
+// Each worker writes its records in blocks of about this many bytes
+const size_t SELFPLAY_BUFFER_SIZE = 1 << 20;
 
 class ChessEngine {
 private:
-    // Board representation: 8x8 board
+    // Board representation: one bitboard per piece code plus per-color occupancy
+    // and a square-indexed mailbox for "what stands on this square" lookups.
     // 0 = empty, 1-6 = white pieces (pawn, knight, bishop, rook, queen, king)
     // 7-12 = black pieces (pawn, knight, bishop, rook, queen, king)
-    std::vector<std::vector<int>> board;
+    Bitboard pieceBB[13];
+    Bitboard colorBB[2];  // 0 = white, 1 = black
+    Bitboard occupied;
+    int mailbox[64];
     bool whiteToMove;
     bool whiteKingMoved;
     bool blackKingMoved;
@@ -24,582 +2711,3782 @@ private:
     bool blackQueensideRookMoved;
     int enPassantCol;
     
-    std::mt19937 rng;
+    // Plies since the last capture or pawn move (the 50-move counter), and
+    // since the last null move. No position further back can repeat.
+    int halfmoveClock;
+    int pliesFromNull;
+    
+    // Zobrist key of the current position, updated incrementally, and a
+    // second key covering only the pawns and kings for the pawn hash table
+    uint64_t key;
+    uint64_t pawnKey;
+    
+    // Enemy pieces giving check, and own pieces pinned to the king. Computed
+    // once per position by updateCheckInfo and used by the legal generator.
+    Bitboard checkers;
+    Bitboard pinned;
+    
+    // Running material + piece-square sums (white minus black) for both game
+    // phases, and the phase counter, updated by putPiece/removePiece
+    int psqtMg;
+    int psqtEg;
+    int phase;
+    
+    // Per-thread caches: pawn structure scores by pawnKey, and whole static
+    // evaluations by key. Pawn configurations repeat all over the tree.
+    std::vector<PawnEntry> pawnTable;
+    std::vector<EvalCacheEntry> evalCache;
+    
+    // NNUE accumulators by ply since the position was set up, see Accumulator.
+    // Kept on the heap: the engine is copied for every search thread.
+    std::vector<Accumulator> accumulators;
+    int accumulatorIndex;
+    
+    // One entry per move made on this engine, popped again by unmakeMove. The
+    // tablebase probes at the deepest plies make up to TB_PIECES more moves.
+    UndoInfo undoStack[MAX_GAME_PLY + MAX_PLY + TB_PIECES];
+    int undoCount;
+    
+    // Positions visited by the current search
+    uint64_t nodes;
+    
+    // Search limits and clock. No new iteration starts after the soft limit; the
+    // search is aborted as soon as the hard limit is hit (0 = no time limit).
+    SearchLimits limits;
+    std::chrono::steady_clock::time_point searchStart;
+    int64_t softTimeLimit;
+    int64_t hardTimeLimit;
+    bool stopped;
+    
+    // While pondering our clock is not running yet; it starts at "ponderhit",
+    // and the time limits are measured from then on
+    bool waitingForPonderhit;
+    int64_t ponderhitTime;
+    int64_t lastInfoTime;
+    
+    // Set while a search runs; its stop flag is raised to stop all threads
+    SearchControl* control;
+    
+    // The global table unless the engine was given its own; helper threads
+    // copy the pointer and search the same table
+    TranspositionTable* hashTable = &transpositionTable;
+    
+    // Outcome of this engine's last iterative deepening run
+    SearchResult lastResult;
+    Move ponderMove;
+    
+    // Triangular principal variation table: row ply holds the best line found
+    // from ply on, up to pvLength[ply], and is built from row ply + 1 whenever
+    // a move raises alpha
+    Move pvTable[MAX_PLY + 1][MAX_PLY + 1];
+    int pvLength[MAX_PLY + 1];
+    int selDepth;  // Deepest ply reached in the current iteration
+    
+    // Move made at each ply of the current search, NO_MOVE for a null move
+    Move currentMove[MAX_PLY + 1];
+    
+    // Null moves are not tried before this ply while a null move fail high
+    // is being verified
+    int nullMoveMinPly;
+
+#if defined(SEARCH_STATS)
+    mutable SearchStats stats;  // Of the last search; move generation is const
+#endif
+    
+    // Move ordering statistics: two quiet moves per ply that recently caused a
+    // cutoff, and a butterfly table of cutoff success by side, from and to square
+    Move killerMoves[MAX_PLY][2];
+    int history[2][64][64];
+    
+    std::mt19937 rng;
+    
+    void clearBoard() {
+        for (int piece = 0; piece < 13; piece++) {
+            pieceBB[piece] = 0;
+        }
+        colorBB[0] = colorBB[1] = 0;
+        occupied = 0;
+        key = pawnKey = 0;
+        psqtMg = psqtEg = 0;
+        phase = 0;
+        for (int sq = 0; sq < 64; sq++) {
+            mailbox[sq] = 0;
+        }
+    }
+    
+    void putPiece(int sq, int piece) {
+        Bitboard b = squareBB(sq);
+        pieceBB[piece] |= b;
+        colorBB[piece > 6] |= b;
+        occupied |= b;
+        mailbox[sq] = piece;
+        key ^= zobristPieces[piece][sq];
+        if (piece == 1 || piece == 7 || piece == 6 || piece == 12) {
+            pawnKey ^= zobristPieces[piece][sq];
+        }
+        psqtMg += pieceSquareMg[piece][sq];
+        psqtEg += pieceSquareEg[piece][sq];
+        phase += PHASE_WEIGHT[piece > 6 ? piece - 6 : piece];
+    }
+    
+    void removePiece(int sq) {
+        int piece = mailbox[sq];
+        Bitboard b = squareBB(sq);
+        pieceBB[piece] &= ~b;
+        colorBB[piece > 6] &= ~b;
+        occupied &= ~b;
+        mailbox[sq] = 0;
+        key ^= zobristPieces[piece][sq];
+        if (piece == 1 || piece == 7 || piece == 6 || piece == 12) {
+            pawnKey ^= zobristPieces[piece][sq];
+        }
+        psqtMg -= pieceSquareMg[piece][sq];
+        psqtEg -= pieceSquareEg[piece][sq];
+        phase -= PHASE_WEIGHT[piece > 6 ? piece - 6 : piece];
+    }
+    
+    // Recomputes the Zobrist key from scratch, after setting up a position
+    void computeKey() {
+        key = zobristCastling[castlingFlags()];
+        for (int sq = 0; sq < 64; sq++) {
+            key ^= zobristPieces[mailbox[sq]][sq];
+        }
+        if (enPassantCol >= 0) {
+            key ^= zobristEnPassant[enPassantCol];
+        }
+        if (!whiteToMove) {
+            key ^= zobristBlackToMove;
+        }
+    }
+    
+    void initializeBoard() {
+        // Initialize empty board
+        clearBoard();
+        
+        // Set up pawns
+        for (int col = 0; col < 8; col++) {
+            putPiece(8 + col, 1);   // white pawn
+            putPiece(48 + col, 7);  // black pawn
+        }
+        
+        // Set up other pieces
+        const int backRank[8] = { 4, 2, 3, 5, 6, 3, 2, 4 };
+        for (int col = 0; col < 8; col++) {
+            putPiece(col, backRank[col]);           // white pieces
+            putPiece(56 + col, backRank[col] + 6);  // black pieces
+        }
+        
+        whiteToMove = true;
+        whiteKingMoved = false;
+        blackKingMoved = false;
+        whiteKingsideRookMoved = false;
+        whiteQueensideRookMoved = false;
+        blackKingsideRookMoved = false;
+        blackQueensideRookMoved = false;
+        enPassantCol = -1;
+        halfmoveClock = pliesFromNull = 0;
+        undoCount = 0;
+        accumulators.resize(MAX_PLY + 1);
+        pawnTable.assign(PAWN_TABLE_SIZE, PawnEntry());
+        evalCache.assign(EVAL_CACHE_SIZE, EvalCacheEntry());
+        resetAccumulators();
+        checkers = pinned = 0;
+        nodes = 0;
+        stopped = false;
+        control = nullptr;
+        ponderMove = NO_MOVE;
+        std::memset(history, 0, sizeof(history));
+        computeKey();
+        
+        // Initialize random number generator
+        unsigned seed = std::chrono::system_clock::now().time_since_epoch().count();
+        rng = std::mt19937(seed);
+    }
+    
+    int castlingFlags() const {
+        return (whiteKingMoved << 0) | (blackKingMoved << 1)
+             | (whiteKingsideRookMoved << 2) | (whiteQueensideRookMoved << 3)
+             | (blackKingsideRookMoved << 4) | (blackQueensideRookMoved << 5);
+    }
+    
+    void setCastlingFlags(int flags) {
+        whiteKingMoved = flags & 1;
+        blackKingMoved = flags & 2;
+        whiteKingsideRookMoved = flags & 4;
+        whiteQueensideRookMoved = flags & 8;
+        blackKingsideRookMoved = flags & 16;
+        blackQueensideRookMoved = flags & 32;
+    }
+    
+    // Recomputes checkers and pinned for the side to move, Us
+    template <Color Us>
+    void updateCheckInfo() {
+        constexpr int us = Us;
+        constexpr int them = ~Us;
+        checkers = pinned = 0;
+        
+        Bitboard king = pieceBB[us * 6 + 6];
+        if (!king) {
+            return;
+        }
+        int kingSq = lsb(king);
+        checkers = attackersTo(kingSq, occupied) & colorBB[them];
+        
+        // An enemy slider aiming at the king through exactly one own piece pins it
+        Bitboard snipers = (rookAttacks(kingSq, 0) & (pieceBB[them * 6 + 4] | pieceBB[them * 6 + 5]))
+                         | (bishopAttacks(kingSq, 0) & (pieceBB[them * 6 + 3] | pieceBB[them * 6 + 5]));
+        while (snipers) {
+            Bitboard blockers = betweenBB[kingSq][popLsb(snipers)] & occupied;
+            if (popCount(blockers) == 1) {
+                pinned |= blockers & colorBB[us];
+            }
+        }
+    }
+    
+    void updateCheckInfo() {
+        if (whiteToMove) {
+            updateCheckInfo<WHITE>();
+        } else {
+            updateCheckInfo<BLACK>();
+        }
+    }
+    
+    // Pawn structure and king shelter, from white's point of view, for both
+    // game phases: passed, isolated and doubled pawns, and the pawns in
+    // front of each king
+    void evaluatePawnStructure(int& mg, int& eg) const {
+        const Bitboard pawns[2] = { pieceBB[1], pieceBB[7] };
+        const Bitboard kings[2] = { pieceBB[6], pieceBB[12] };
+        PawnTerms terms;
+        countPawnTerms(pawns, kings, terms);
+        
+        mg = eg = 0;
+        for (int rank = 0; rank < 8; rank++) {
+            mg += terms.passed[rank] * PASSED_PAWN_MG[rank];
+            eg += terms.passed[rank] * PASSED_PAWN_EG[rank];
+        }
+        mg += terms.isolated * ISOLATED_PAWN_MG + terms.doubled * DOUBLED_PAWN_MG;
+        eg += terms.isolated * ISOLATED_PAWN_EG + terms.doubled * DOUBLED_PAWN_EG;
+        mg += terms.shelterNear * SHELTER_PAWN_NEAR + terms.shelterFar * SHELTER_PAWN_FAR
+            + terms.shelterOpen * SHELTER_OPEN_FILE;
+    }
+    
+    // Pawn structure entry of the current pawns and kings, computed on a miss
+    const PawnEntry& probePawnTable() {
+        PawnEntry& entry = pawnTable[pawnKey & (PAWN_TABLE_SIZE - 1)];
+        if (entry.key != pawnKey) {
+            entry.key = pawnKey;
+            evaluatePawnStructure(entry.mg, entry.eg);
+        }
+        return entry;
+    }
+    
+    // Makes the current position the root of the accumulator stack, to be
+    // computed from scratch when it is first evaluated
+    void resetAccumulators() {
+        accumulatorIndex = 0;
+        accumulators[0].computed[0] = accumulators[0].computed[1] = false;
+    }
+    
+    // Computes the accumulator of the current position for one perspective from
+    // the feature transformer biases and the weights of every non-king piece
+    void refreshAccumulator(int perspective) {
+        Accumulator& acc = accumulators[accumulatorIndex];
+        int kingSq = lsb(pieceBB[perspective * 6 + 6]);
+        
+        std::memcpy(acc.values[perspective], nnueNetwork.ftBiases, sizeof(acc.values[perspective]));
+        Bitboard pieces = occupied & ~(pieceBB[6] | pieceBB[12]);
+        while (pieces) {
+            int sq = popLsb(pieces);
+            int feature = nnueFeature(perspective, kingSq, mailbox[sq], sq);
+            nnueAddColumn(acc.values[perspective], nnueNetwork.ftWeights + size_t(feature) * NNUE_L1);
+        }
+        acc.computed[perspective] = true;
+    }
+    
+    // Brings the accumulator of the current position up to date for one
+    // perspective by replaying the piece changes since the last computed ply.
+    // A move of the perspective's own king changes every feature, so it forces
+    // a refresh instead.
+    void updateAccumulator(int perspective) {
+        int king = perspective * 6 + 6;
+        int last = accumulatorIndex;
+        
+        while (!accumulators[last].computed[perspective]) {
+            const Accumulator& acc = accumulators[last];
+            bool kingMoved = false;
+            for (int i = 0; i < acc.dirtyCount; i++) {
+                kingMoved |= acc.dirty[i].piece == king;
+            }
+            if (last == 0 || kingMoved) {
+                refreshAccumulator(perspective);
+                return;
+            }
+            last--;
+        }
+        
+        int kingSq = lsb(pieceBB[king]);
+        for (int ply = last + 1; ply <= accumulatorIndex; ply++) {
+            Accumulator& acc = accumulators[ply];
+            int16_t* values = acc.values[perspective];
+            std::memcpy(values, accumulators[ply - 1].values[perspective], sizeof(acc.values[perspective]));
+            
+            for (int i = 0; i < acc.dirtyCount; i++) {
+                const DirtyPiece& dirty = acc.dirty[i];
+                if (dirty.piece == 6 || dirty.piece == 12) {
+                    continue;  // Kings are part of the feature index, not features
+                }
+                int feature = nnueFeature(perspective, kingSq, dirty.piece, dirty.square);
+                const int16_t* column = nnueNetwork.ftWeights + size_t(feature) * NNUE_L1;
+                if (dirty.added) {
+                    nnueAddColumn(values, column);
+                } else {
+                    nnueSubColumn(values, column);
+                }
+            }
+            acc.computed[perspective] = true;
+        }
+    }
+    
+    // Network evaluation of the current position from the side to move's point of view
+    int evaluateNNUE() {
+        updateAccumulator(0);
+        updateAccumulator(1);
+        
+        const Accumulator& acc = accumulators[accumulatorIndex];
+        int us = whiteToMove ? 0 : 1;
+        alignas(64) uint8_t input[2 * NNUE_L1];
+        alignas(64) uint8_t hidden1[NNUE_L2];
+        alignas(64) uint8_t hidden2[NNUE_L3];
+        
+        nnueClipAccumulator(input, acc.values[us]);
+        nnueClipAccumulator(input + NNUE_L1, acc.values[us ^ 1]);
+        nnueHiddenLayer(hidden1, input, nnueNetwork.l1Weights, nnueNetwork.l1Biases, 2 * NNUE_L1, NNUE_L2);
+        nnueHiddenLayer(hidden2, hidden1, nnueNetwork.l2Weights, nnueNetwork.l2Biases, NNUE_L2, NNUE_L3);
+        int32_t output = *nnueNetwork.outBias + nnueDot(hidden2, nnueNetwork.outWeights, NNUE_L3);
+        
+        // Keep network scores out of the mate range
+        int limit = MATE_SCORE - MAX_PLY - 1;
+        return std::max(-limit, std::min(limit, int(output / NNUE_OUTPUT_SCALE)));
+    }
+    
+    // Adds one move per set bit of targets, all starting from the same square
+    void addMoves(int from, Bitboard targets, MoveList& moves) const {
+        while (targets) {
+            moves.add(Move(from, popLsb(targets)));
+        }
+    }
+    
+    // Adds the four promotion choices for a pawn reaching the last rank
+    void addPromotions(int from, int to, MoveList& moves) const {
+        for (int type = 5; type >= 2; type--) {
+            moves.add(Move(from, to, PROMOTION, type));
+        }
+    }
+    
+    // Populates moves with all legal moves
+    void getAllLegalMoves(MoveList& moves) const {
+        moves.clear();
+        generateMoves(moves, GEN_ALL);
+    }
+    
+    // Appends the legal moves of the given kind to moves. In check only evasions
+    // are generated: king moves, and with a single checker, captures of it and
+    // interpositions. Pinned pieces only move along the line to their king.
+    template <Color Us>
+    void generateMoves(MoveList& moves, GenType type) const {
+        STATS(StatsTimer timer(stats.movegenNanos));
+        Bitboard targets = (type == GEN_CAPTURES) ? colorBB[~Us]
+                         : (type == GEN_QUIETS) ? ~occupied
+                         : ~colorBB[Us];
+        
+        // In double check only the king can move
+        if (popCount(checkers) < 2) {
+            Bitboard evasionMask = checkMask<Us>();
+            getPawnMoves<Us>(moves, type, evasionMask);
+            getKnightMoves<Us>(moves, targets & evasionMask);
+            getBishopMoves<Us>(moves, targets & evasionMask);  // Bishops and the diagonal half of queen moves
+            getRookMoves<Us>(moves, targets & evasionMask);    // Rooks and the straight half of queen moves
+        }
+        getKingMoves<Us>(moves, targets, type != GEN_CAPTURES);
+    }
+    
+    void generateMoves(MoveList& moves, GenType type) const {
+        if (whiteToMove) {
+            generateMoves<WHITE>(moves, type);
+        } else {
+            generateMoves<BLACK>(moves, type);
+        }
+    }
+    
+    // Target squares for non-king moves: everything when not in check, otherwise
+    // the checker and the squares between it and the king
+    template <Color Us>
+    Bitboard checkMask() const {
+        if (!checkers) {
+            return ~Bitboard(0);
+        }
+        int kingSq = lsb(pieceBB[Us * 6 + 6]);
+        return betweenBB[kingSq][lsb(checkers)] | checkers;
+    }
+    
+    // Squares a piece on from may move to without exposing its king
+    template <Color Us>
+    Bitboard pinMask(int from) const {
+        if (!(pinned & squareBB(from))) {
+            return ~Bitboard(0);
+        }
+        return lineBB[lsb(pieceBB[Us * 6 + 6])][from];
+    }
+    
+    // En passant removes two pawns from one rank at once, which can uncover a
+    // slider on the king that no pin covers, so it is tested on the resulting
+    // occupancy. In check it must also remove a pawn or knight checker.
+    template <Color Us>
+    bool isEnPassantLegal(int from, int to) const {
+        constexpr int us = Us;
+        constexpr int them = ~Us;
+        int kingSq = lsb(pieceBB[us * 6 + 6]);
+        int capturedSq = (from & ~7) | (to & 7);
+        Bitboard occ = (occupied ^ squareBB(from) ^ squareBB(capturedSq)) | squareBB(to);
+        
+        Bitboard leaperCheckers = checkers & (pieceBB[them * 6 + 1] | pieceBB[them * 6 + 2]);
+        if (leaperCheckers & ~squareBB(capturedSq)) {
+            return false;
+        }
+        return !(rookAttacks(kingSq, occ) & (pieceBB[them * 6 + 4] | pieceBB[them * 6 + 5]))
+            && !(bishopAttacks(kingSq, occ) & (pieceBB[them * 6 + 3] | pieceBB[them * 6 + 5]));
+    }
+    
+    template <Color Us>
+    void getPawnMoves(MoveList& moves, GenType type, Bitboard evasionMask) const {
+        constexpr int forward = Us == WHITE ? 8 : -8;
+        constexpr Bitboard startRank = Us == WHITE ? RANK_2_BB : RANK_7_BB;
+        constexpr Bitboard lastRank = Us == WHITE ? RANK_8_BB : RANK_1_BB;
+        Bitboard enemies = colorBB[~Us];
+        Bitboard pawns = pieceBB[Us * 6 + 1];
+        bool noisy = (type != GEN_QUIETS);
+        bool quiet = (type != GEN_CAPTURES);
+        
+        while (pawns) {
+            int from = popLsb(pawns);
+            int to = from + forward;
+            Bitboard allowed = evasionMask & pinMask<Us>(from);
+            
+            // Forward one square, and two from the starting position. Pushes to
+            // the last rank are promotions, which count as captures here.
+            if (!(occupied & squareBB(to))) {
+                if (lastRank & squareBB(to)) {
+                    if (noisy && (allowed & squareBB(to))) {
+                        addPromotions(from, to, moves);
+                    }
+                } else if (quiet) {
+                    if (allowed & squareBB(to)) {
+                        moves.add(Move(from, to));
+                    }
+                    
+                    if ((startRank & squareBB(from)) && !(occupied & squareBB(to + forward))
+                        && (allowed & squareBB(to + forward))) {
+                        moves.add(Move(from, to + forward));
+                    }
+                }
+            }
+            
+            if (!noisy) {
+                continue;
+            }
+            
+            // Diagonal captures
+            Bitboard captures = pawnAttackTable[Us][from] & enemies & allowed;
+            while (captures) {
+                int target = popLsb(captures);
+                if (lastRank & squareBB(target)) {
+                    addPromotions(from, target, moves);
+                } else {
+                    moves.add(Move(from, target));
+                }
+            }
+            
+            // En passant capture
+            if (enPassantCol >= 0) {
+                int epSquare = (Us == WHITE ? 5 : 2) * 8 + enPassantCol;
+                if ((pawnAttackTable[Us][from] & squareBB(epSquare)) && isEnPassantLegal<Us>(from, epSquare)) {
+                    moves.add(Move(from, epSquare, EN_PASSANT));
+                }
+            }
+        }
+    }
+    
+    template <Color Us>
+    void getKnightMoves(MoveList& moves, Bitboard targets) const {
+        Bitboard knights = pieceBB[Us * 6 + 2] & ~pinned;  // A pinned knight can never move
+        
+        while (knights) {
+            int from = popLsb(knights);
+            addMoves(from, knightAttackTable[from] & targets, moves);
+        }
+    }
+    
+    template <Color Us>
+    void getBishopMoves(MoveList& moves, Bitboard targets) const {
+        Bitboard sliders = pieceBB[Us * 6 + 3] | pieceBB[Us * 6 + 5];
+        
+        while (sliders) {
+            int from = popLsb(sliders);
+            addMoves(from, bishopAttacks(from, occupied) & targets & pinMask<Us>(from), moves);
+        }
+    }
+    
+    template <Color Us>
+    void getRookMoves(MoveList& moves, Bitboard targets) const {
+        Bitboard sliders = pieceBB[Us * 6 + 4] | pieceBB[Us * 6 + 5];
+        
+        while (sliders) {
+            int from = popLsb(sliders);
+            addMoves(from, rookAttacks(from, occupied) & targets & pinMask<Us>(from), moves);
+        }
+    }
+    
+    template <Color Us>
+    void getKingMoves(MoveList& moves, Bitboard targets, bool castling) const {
+        Bitboard kings = pieceBB[Us * 6 + 6];
+        if (!kings) {
+            return;
+        }
+        
+        // Normal king moves, to squares not attacked once the king has left its
+        // square (so it cannot step back along the line of a checking slider)
+        int from = lsb(kings);
+        constexpr int them = ~Us;
+        Bitboard kingTargets = kingAttackTable[from] & targets;
+        while (kingTargets) {
+            int to = popLsb(kingTargets);
+            if (!(attackersTo(to, occupied ^ kings) & colorBB[them])) {
+                moves.add(Move(from, to));
+            }
+        }
+        
+        // Castling: never out of or through check, nor into it
+        if (!castling || checkers) {
+            return;
+        }
+        
+        constexpr int kingStart = Us == WHITE ? 4 : 60;
+        constexpr int rook = Us * 6 + 4;
+        constexpr Bitboard kingsideGap = 0x60ULL << (kingStart - 4);
+        constexpr Bitboard queensideGap = 0x0EULL << (kingStart - 4);
+        bool kingMoved = Us == WHITE ? whiteKingMoved : blackKingMoved;
+        bool kingsideRookMoved = Us == WHITE ? whiteKingsideRookMoved : blackKingsideRookMoved;
+        bool queensideRookMoved = Us == WHITE ? whiteQueensideRookMoved : blackQueensideRookMoved;
+        
+        if (!kingMoved && from == kingStart) {
+            // Kingside castling
+            if (!kingsideRookMoved && !(occupied & kingsideGap) && mailbox[kingStart + 3] == rook
+                && !isSquareAttacked(kingStart + 1, them) && !isSquareAttacked(kingStart + 2, them)) {
+                moves.add(Move(from, kingStart + 2, CASTLING));
+            }
+            // Queenside castling
+            if (!queensideRookMoved && !(occupied & queensideGap) && mailbox[kingStart - 4] == rook
+                && !isSquareAttacked(kingStart - 1, them) && !isSquareAttacked(kingStart - 2, them)) {
+                moves.add(Move(from, kingStart - 2, CASTLING));
+            }
+        }
+    }
+    
+    // True for captures, en passant and promotions: the moves generated by GEN_CAPTURES
+    bool isNoisy(Move move) const {
+        return mailbox[move.to()] != 0 || move.kind() == PROMOTION || move.kind() == EN_PASSANT;
+    }
+    
+    // Checks that a move from somewhere else (hash table, killer slot) is one the
+    // generator could produce in this position, without generating all moves.
+    template <Color Us>
+    bool isPseudoLegal(Move move) const {
+        if (move == NO_MOVE) {
+            return false;
+        }
+        
+        constexpr int us = Us;
+        int from = move.from();
+        int to = move.to();
+        int piece = mailbox[from];
+        
+        if (piece == 0 || (piece > 6) != bool(us) || (colorBB[us] & squareBB(to))) {
+            return false;
+        }
+        
+        int type = piece > 6 ? piece - 6 : piece;
+        
+        if (move.kind() == CASTLING) {
+            MoveList castles;
+            getKingMoves<Us>(castles, 0, true);
+            return std::find(castles.begin(), castles.end(), move) != castles.end();
+        }
+        
+        if (type == 1) {
+            constexpr int forward = Us == WHITE ? 8 : -8;
+            constexpr Bitboard lastRank = Us == WHITE ? RANK_8_BB : RANK_1_BB;
+            
+            if (move.kind() == EN_PASSANT) {
+                return enPassantCol >= 0 && to == (Us == WHITE ? 5 : 2) * 8 + enPassantCol
+                    && (pawnAttackTable[us][from] & squareBB(to));
+            }
+            if (bool(lastRank & squareBB(to)) != (move.kind() == PROMOTION)) {
+                return false;
+            }
+            if (pawnAttackTable[us][from] & colorBB[us ^ 1] & squareBB(to)) {
+                return true;
+            }
+            if (to == from + forward) {
+                return !(occupied & squareBB(to));
+            }
+            constexpr Bitboard startRank = Us == WHITE ? RANK_2_BB : RANK_7_BB;
+            return to == from + 2 * forward && (startRank & squareBB(from))
+                && !(occupied & (squareBB(from + forward) | squareBB(to)));
+        }
+        
+        if (move.kind() != NORMAL) {
+            return false;
+        }
+        
+        Bitboard attacks = (type == 2) ? knightAttackTable[from]
+                         : (type == 3) ? bishopAttacks(from, occupied)
+                         : (type == 4) ? rookAttacks(from, occupied)
+                         : (type == 5) ? bishopAttacks(from, occupied) | rookAttacks(from, occupied)
+                         : kingAttackTable[from];
+        return attacks & squareBB(to);
+    }
+    
+    // Whether a pseudo-legal move leaves the own king safe, decided from the
+    // check and pin information rather than by making the move
+    template <Color Us>
+    bool isLegal(Move move) const {
+        int from = move.from();
+        int to = move.to();
+        
+        if (move.kind() == EN_PASSANT) {
+            return isEnPassantLegal<Us>(from, to);
+        }
+        if (move.kind() == CASTLING) {
+            return true;  // isPseudoLegal already went through the legal generator
+        }
+        if (squareBB(from) & pieceBB[Us * 6 + 6]) {
+            return !(attackersTo(to, occupied ^ squareBB(from)) & colorBB[~Us]);
+        }
+        return popCount(checkers) < 2 && (checkMask<Us>() & pinMask<Us>(from) & squareBB(to));
+    }
+    
+    // A move from outside the search (such as the expected ponder reply) that
+    // is legal in the current position
+    bool isValidMove(Move move) const {
+        return whiteToMove ? isPseudoLegal<WHITE>(move) && isLegal<WHITE>(move)
+                           : isPseudoLegal<BLACK>(move) && isLegal<BLACK>(move);
+    }
+    
+    // Hands out the moves of a node one at a time, best guesses first: the hash
+    // move, then captures by MVV-LVA, then the two killer moves, then the
+    // remaining quiet moves by history score, and finally the captures that
+    // lose material by static exchange. Moves are generated per stage, so a
+    // cutoff on the hash move or a capture never pays for quiet generation.
+    // The quiescence search uses a captures-only picker that drops losing
+    // captures instead of deferring them. Us is the side to move.
+    template <Color Us>
+    class MovePicker {
+        enum Stage {
+            STAGE_TT,
+            STAGE_GEN_CAPTURES,
+            STAGE_CAPTURES,
+            STAGE_KILLERS,
+            STAGE_GEN_QUIETS,
+            STAGE_QUIETS,
+            STAGE_BAD_CAPTURES,
+            STAGE_DONE
+        };
+        
+        ChessEngine& engine;
+        Move ttMove;
+        Move killers[2];
+        bool capturesOnly;
+        int stage;
+        int index;
+        MoveList moves;
+        int scores[256];
+        MoveList badCaptures;
+        
+        // Moves the highest scored remaining move to index and returns it
+        Move pickBest() {
+            int best = index;
+            for (int i = index + 1; i < moves.size(); i++) {
+                if (scores[i] > scores[best]) {
+                    best = i;
+                }
+            }
+            std::swap(moves[index], moves[best]);
+            std::swap(scores[index], scores[best]);
+            return moves[index++];
+        }
+        
+    public:
+        MovePicker(ChessEngine& engine, Move ttMove, int ply)
+            : engine(engine), ttMove(ttMove), capturesOnly(false), stage(STAGE_TT), index(0) {
+            killers[0] = engine.killerMoves[ply][0];
+            killers[1] = engine.killerMoves[ply][1];
+        }
+        
+        // Captures-only picker for the quiescence search
+        explicit MovePicker(ChessEngine& engine)
+            : engine(engine), ttMove(NO_MOVE), capturesOnly(true), stage(STAGE_GEN_CAPTURES), index(0) {
+            killers[0] = killers[1] = NO_MOVE;
+        }
+        
+        // Returns the next move, or NO_MOVE once all moves have been handed out
+        Move next() {
+            while (true) {
+                switch (stage) {
+                    case STAGE_TT:
+                        stage = STAGE_GEN_CAPTURES;
+                        if (engine.isPseudoLegal<Us>(ttMove) && engine.isLegal<Us>(ttMove)) {
+                            return ttMove;
+                        }
+                        break;
+                    
+                    case STAGE_GEN_CAPTURES:
+                        moves.clear();
+                        engine.generateMoves<Us>(moves, GEN_CAPTURES);
+                        for (int i = 0; i < moves.size(); i++) {
+                            scores[i] = engine.captureScore(moves[i]);
+                        }
+                        index = 0;
+                        stage = STAGE_CAPTURES;
+                        break;
+                    
+                    case STAGE_CAPTURES:
+                        while (index < moves.size()) {
+                            Move move = pickBest();
+                            if (move == ttMove) {
+                                continue;
+                            }
+                            if (engine.see(move) >= 0) {
+                                return move;
+                            }
+                            if (!capturesOnly) {
+                                badCaptures.add(move);
+                            }
+                        }
+                        index = 0;
+                        stage = capturesOnly ? STAGE_DONE : STAGE_KILLERS;
+                        break;
+                    
+                    case STAGE_KILLERS:
+                        while (index < 2) {
+                            Move move = killers[index++];
+                            if (move != ttMove && engine.isPseudoLegal<Us>(move) && !engine.isNoisy(move)
+                                && engine.isLegal<Us>(move)) {
+                                return move;
+                            }
+                        }
+                        stage = STAGE_GEN_QUIETS;
+                        break;
+                    
+                    case STAGE_GEN_QUIETS:
+                        moves.clear();
+                        engine.generateMoves<Us>(moves, GEN_QUIETS);
+                        for (int i = 0; i < moves.size(); i++) {
+                            scores[i] = engine.historyScore(moves[i]);
+                        }
+                        index = 0;
+                        stage = STAGE_QUIETS;
+                        break;
+                    
+                    case STAGE_QUIETS:
+                        while (index < moves.size()) {
+                            Move move = pickBest();
+                            if (move != ttMove && move != killers[0] && move != killers[1]) {
+                                return move;
+                            }
+                        }
+                        index = 0;
+                        stage = STAGE_BAD_CAPTURES;
+                        break;
+                    
+                    case STAGE_BAD_CAPTURES:
+                        if (index < badCaptures.size()) {
+                            return badCaptures[index++];
+                        }
+                        stage = STAGE_DONE;
+                        break;
+                    
+                    default:
+                        return NO_MOVE;
+                }
+            }
+        }
+    };
+    
+    // Most valuable victim, least valuable attacker: winning a queen with a pawn
+    // first, a pawn with a queen last. Promotions rank by the promoted piece.
+    int captureScore(Move move) const {
+        const int orderValues[7] = { 0, 1, 3, 3, 5, 9, 0 };
+        int attacker = mailbox[move.from()];
+        int victim = (move.kind() == EN_PASSANT) ? 1 : mailbox[move.to()];
+        int victimType = victim > 6 ? victim - 6 : victim;
+        int attackerType = attacker > 6 ? attacker - 6 : attacker;
+        
+        int score = orderValues[victimType] * 16 - orderValues[attackerType];
+        if (move.kind() == PROMOTION) {
+            score += orderValues[move.promotionType()] * 16;
+        }
+        return score;
+    }
+    
+    // Every piece of either color that attacks sq, given the occupancy occ
+    Bitboard attackersTo(int sq, Bitboard occ) const {
+        return (pawnAttackTable[1][sq] & pieceBB[1])
+             | (pawnAttackTable[0][sq] & pieceBB[7])
+             | (knightAttackTable[sq] & (pieceBB[2] | pieceBB[8]))
+             | (kingAttackTable[sq] & (pieceBB[6] | pieceBB[12]))
+             | (bishopAttacks(sq, occ) & (pieceBB[3] | pieceBB[5] | pieceBB[9] | pieceBB[11]))
+             | (rookAttacks(sq, occ) & (pieceBB[4] | pieceBB[5] | pieceBB[10] | pieceBB[11]));
+    }
+    
+    // Static exchange evaluation: the material balance of the capture sequence
+    // on the target square when both sides always recapture with their least
+    // valuable attacker and may stop whenever continuing would lose material.
+    // Sliders hidden behind a capturing piece join in as it leaves (x-rays).
+    int see(Move move) const {
+        if (move.kind() == CASTLING) {
+            return 0;
+        }
+        
+        int from = move.from();
+        int to = move.to();
+        int gain[32];
+        int depth = 0;
+        
+        Bitboard occ = occupied ^ squareBB(from);
+        int captured = mailbox[to];
+        if (move.kind() == EN_PASSANT) {
+            captured = whiteToMove ? 7 : 1;
+            occ ^= squareBB((from & ~7) | (to & 7));
+        }
+        
+        // Value of the piece standing on the target square after each capture
+        int onSquare = SEE_VALUES[mailbox[from]];
+        gain[0] = SEE_VALUES[captured];
+        if (move.kind() == PROMOTION) {
+            onSquare = SEE_VALUES[move.promotionType()];
+            gain[0] += onSquare - SEE_VALUES[1];
+        }
+        
+        Bitboard attackers = attackersTo(to, occ) & occ;
+        int side = whiteToMove ? 1 : 0;  // The side to recapture next
+        
+        while (depth < 31) {
+            // Speculative gain if the side to recapture takes the piece on the square
+            depth++;
+            gain[depth] = onSquare - gain[depth - 1];
+            if (std::max(-gain[depth - 1], gain[depth]) < 0) {
+                break;  // Neither side can profit from continuing
+            }
+            
+            // Least valuable attacker of the side to recapture
+            Bitboard candidates = attackers & colorBB[side];
+            if (!candidates) {
+                break;
+            }
+            
+            int attackerSq = -1;
+            for (int type = 1; type <= 6; type++) {
+                Bitboard b = candidates & pieceBB[type + side * 6];
+                if (b) {
+                    attackerSq = lsb(b);
+                    break;
+                }
+            }
+            
+            onSquare = SEE_VALUES[mailbox[attackerSq]];
+            occ ^= squareBB(attackerSq);
+            attackers = attackersTo(to, occ) & occ;
+            side ^= 1;
+        }
+        
+        // The last speculative capture never happened; unwind the rest letting
+        // each side stop the sequence when continuing would lose
+        while (--depth > 0) {
+            gain[depth - 1] = -std::max(-gain[depth - 1], gain[depth]);
+        }
+        return gain[0];
+    }
+    
+    int historyScore(Move move) const {
+        return history[whiteToMove ? 0 : 1][move.from()][move.to()];
+    }
+    
+    // Makes move, followed by the line found below it, the best line from ply
+    void updatePv(int ply, Move move) {
+        pvTable[ply][ply] = move;
+        for (int i = ply + 1; i < pvLength[ply + 1]; i++) {
+            pvTable[ply][i] = pvTable[ply + 1][i];
+        }
+        pvLength[ply] = std::max(pvLength[ply + 1], ply + 1);
+    }
+    
+    // Rewards a quiet move that caused a beta cutoff and penalizes the quiet moves
+    // searched before it. The bonus shrinks as a score approaches MAX_HISTORY,
+    // which keeps the table bounded and lets it adapt as the search moves on.
+    void updateQuietStats(Move bestMove, const Move* quietsTried, int quietCount, int depth, int ply) {
+        int us = whiteToMove ? 0 : 1;
+        int bonus = std::min(depth * depth, 400);
+        
+        auto update = [&](Move move, int delta) {
+            int& entry = history[us][move.from()][move.to()];
+            entry += delta - entry * std::abs(delta) / MAX_HISTORY;
+        };
+        
+        update(bestMove, bonus);
+        for (int i = 0; i < quietCount; i++) {
+            if (quietsTried[i] != bestMove) {
+                update(quietsTried[i], -bonus);
+            }
+        }
+        
+        if (killerMoves[ply][0] != bestMove) {
+            killerMoves[ply][1] = killerMoves[ply][0];
+            killerMoves[ply][0] = bestMove;
+        }
+    }
+    
+    // Makes a move produced by the move generator for Us, the side to move
+    template <Color Us>
+    void makeMove(Move move) {
+        constexpr int base = Us * 6;
+        constexpr int kingStart = Us == WHITE ? 4 : 60;
+        int from = move.from();
+        int to = move.to();
+        int piece = mailbox[from];
+        
+        // Save what unmakeMove needs before anything changes
+        UndoInfo& undo = undoStack[undoCount++];
+        undo.movedPiece = piece;
+        undo.capturedPiece = mailbox[to];
+        undo.capturedSquare = to;
+        undo.castlingFlags = castlingFlags();
+        undo.enPassantCol = enPassantCol;
+        undo.key = key;
+        undo.checkers = checkers;
+        undo.pinned = pinned;
+        undo.halfmoveClock = halfmoveClock;
+        undo.pliesFromNull = pliesFromNull;
+        
+        // Captures and pawn moves are irreversible and reset the 50-move counter
+        halfmoveClock = (piece == base + 1 || mailbox[to] != 0) ? 0 : halfmoveClock + 1;
+        pliesFromNull++;
+        
+        // Reset en passant
+        enPassantCol = -1;
+        
+        // Check for pawn double move (for en passant)
+        if (piece == base + 1 && std::abs(from - to) == 16) {
+            enPassantCol = from % 8;
+        }
+        
+        if (move.kind() == EN_PASSANT) {
+            // The captured pawn sits beside the mover, not on the target square
+            undo.capturedSquare = (from & ~7) | (to & 7);
+            undo.capturedPiece = mailbox[undo.capturedSquare];
+            removePiece(undo.capturedSquare);
+        } else if (move.kind() == CASTLING) {
+            // Move the rook; the king itself moves below like any other piece
+            int rookFrom = (to > from) ? from + 3 : from - 4;
+            int rookTo = (to > from) ? from + 1 : from - 1;
+            int rook = mailbox[rookFrom];
+            removePiece(rookFrom);
+            putPiece(rookTo, rook);
+        }
+        
+        // Update castling rights for rooks
+        if (piece == base + 4) {
+            if (from == kingStart - 4) (Us == WHITE ? whiteQueensideRookMoved : blackQueensideRookMoved) = true;
+            if (from == kingStart + 3) (Us == WHITE ? whiteKingsideRookMoved : blackKingsideRookMoved) = true;
+        }
+        
+        // Capturing a rook on its starting square takes away the opponent's right
+        constexpr int theirKingStart = Us == WHITE ? 60 : 4;
+        if (to == theirKingStart - 4) (Us == WHITE ? blackQueensideRookMoved : whiteQueensideRookMoved) = true;
+        if (to == theirKingStart + 3) (Us == WHITE ? blackKingsideRookMoved : whiteKingsideRookMoved) = true;
+        
+        // Update king moved flag
+        if (piece == base + 6) (Us == WHITE ? whiteKingMoved : blackKingMoved) = true;
+        
+        // Move the piece
+        if (mailbox[to] != 0) {
+            removePiece(to);
+        }
+        removePiece(from);
+        
+        // Pawn promotion to the chosen piece type
+        if (move.kind() == PROMOTION) {
+            piece = move.promotionType() + base;
+        }
+        putPiece(to, piece);
+        
+        // Piece moves are already hashed by putPiece/removePiece
+        key ^= zobristCastling[undo.castlingFlags] ^ zobristCastling[castlingFlags()];
+        if (undo.enPassantCol >= 0) {
+            key ^= zobristEnPassant[undo.enPassantCol];
+        }
+        if (enPassantCol >= 0) {
+            key ^= zobristEnPassant[enPassantCol];
+        }
+        key ^= zobristBlackToMove;
+        
+        // Record the piece changes for the next accumulator, which is computed
+        // lazily when (and if) the new position is evaluated by the network
+        if (accumulatorIndex == MAX_PLY) {
+            resetAccumulators();
+        }
+        Accumulator& acc = accumulators[++accumulatorIndex];
+        acc.computed[0] = acc.computed[1] = false;
+        acc.dirtyCount = 0;
+        acc.dirty[acc.dirtyCount++] = { undo.movedPiece, from, false };
+        acc.dirty[acc.dirtyCount++] = { piece, to, true };
+        if (undo.capturedPiece != 0) {
+            acc.dirty[acc.dirtyCount++] = { undo.capturedPiece, undo.capturedSquare, false };
+        }
+        if (move.kind() == CASTLING) {
+            constexpr int rook = base + 4;
+            acc.dirty[acc.dirtyCount++] = { rook, (to > from) ? from + 3 : from - 4, false };
+            acc.dirty[acc.dirtyCount++] = { rook, (to > from) ? from + 1 : from - 1, true };
+        }
+        
+        // Switch player
+        whiteToMove = Us == BLACK;
+        updateCheckInfo<~Us>();
+    }
+    
+    void makeMove(Move move) {
+        if (whiteToMove) {
+            makeMove<WHITE>(move);
+        } else {
+            makeMove<BLACK>(move);
+        }
+    }
+    
+    // Returns true when sq is attacked by any piece of the given color (0 = white, 1 = black)
+    bool isSquareAttacked(int sq, int byColor) const {
+        int base = byColor * 6;
+        return (pawnAttackTable[byColor ^ 1][sq] & pieceBB[base + 1])
+            || (knightAttackTable[sq] & pieceBB[base + 2])
+            || (kingAttackTable[sq] & pieceBB[base + 6])
+            || (bishopAttacks(sq, occupied) & (pieceBB[base + 3] | pieceBB[base + 5]))
+            || (rookAttacks(sq, occupied) & (pieceBB[base + 4] | pieceBB[base + 5]));
+    }
+    
+    // Takes back the last move made with makeMove; move must be that same move,
+    // made by Us
+    template <Color Us>
+    void unmakeMove(Move move) {
+        int from = move.from();
+        int to = move.to();
+        const UndoInfo& undo = undoStack[--undoCount];
+        
+        whiteToMove = Us == WHITE;
+        
+        // Put the moving piece back (un-promoting it) and restore any capture
+        removePiece(to);
+        putPiece(from, undo.movedPiece);
+        if (undo.capturedPiece != 0) {
+            putPiece(undo.capturedSquare, undo.capturedPiece);
+        }
+        
+        // Move the rook back after castling
+        if (move.kind() == CASTLING) {
+            int rookFrom = (to > from) ? from + 3 : from - 4;
+            int rookTo = (to > from) ? from + 1 : from - 1;
+            int rook = mailbox[rookTo];
+            removePiece(rookTo);
+            putPiece(rookFrom, rook);
+        }
+        
+        setCastlingFlags(undo.castlingFlags);
+        enPassantCol = undo.enPassantCol;
+        key = undo.key;
+        checkers = undo.checkers;
+        pinned = undo.pinned;
+        halfmoveClock = undo.halfmoveClock;
+        pliesFromNull = undo.pliesFromNull;
+        
+        if (accumulatorIndex > 0) {
+            accumulatorIndex--;
+        } else {
+            resetAccumulators();  // The stack wrapped around inside makeMove
+        }
+    }
+    
+    void unmakeMove(Move move) {
+        if (whiteToMove) {
+            unmakeMove<BLACK>(move);
+        } else {
+            unmakeMove<WHITE>(move);
+        }
+    }
+    
+    // Passes the turn to the other side, for null move pruning. Us must not be
+    // in check. The pieces do not change, so neither do the NNUE accumulators.
+    template <Color Us>
+    void makeNullMove() {
+        UndoInfo& undo = undoStack[undoCount++];
+        undo.enPassantCol = enPassantCol;
+        undo.key = key;
+        undo.checkers = checkers;
+        undo.pinned = pinned;
+        undo.halfmoveClock = halfmoveClock;
+        undo.pliesFromNull = pliesFromNull;
+        
+        halfmoveClock++;
+        pliesFromNull = 0;
+        if (enPassantCol >= 0) {
+            key ^= zobristEnPassant[enPassantCol];
+            enPassantCol = -1;
+        }
+        key ^= zobristBlackToMove;
+        whiteToMove = Us == BLACK;
+        updateCheckInfo<~Us>();
+    }
+    
+    template <Color Us>
+    void unmakeNullMove() {
+        const UndoInfo& undo = undoStack[--undoCount];
+        whiteToMove = Us == WHITE;
+        enPassantCol = undo.enPassantCol;
+        key = undo.key;
+        checkers = undo.checkers;
+        pinned = undo.pinned;
+        halfmoveClock = undo.halfmoveClock;
+        pliesFromNull = undo.pliesFromNull;
+    }
+    
+    // Whether the position is drawn by the 50-move rule or by repetition. The
+    // keys of earlier positions are on the undo stack, and only those since
+    // the last irreversible move (and null move) need to be compared, every
+    // second one as the side to move must match. A repetition of a position
+    // from inside the search is scored as a draw at once, since the side
+    // that could avoid it would; one from the game before the root must have
+    // occurred twice already.
+    bool isDraw(int ply) const {
+        if (halfmoveClock >= 100) {
+            if (!checkers) {
+                return true;
+            }
+            MoveList moves;  // Mate on the hundredth ply still counts
+            getAllLegalMoves(moves);
+            return !moves.empty();
+        }
+        
+        int distance = std::min(std::min(halfmoveClock, pliesFromNull), undoCount);
+        int repetitions = 0;
+        for (int i = 4; i <= distance; i += 2) {
+            if (undoStack[undoCount - i].key == key && (i < ply || ++repetitions == 2)) {
+                return true;
+            }
+        }
+        return false;
+    }
+    
+    // Milliseconds since the current search started
+    int64_t elapsedTime() const {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - searchStart).count();
+    }
+    
+    // Splits the remaining clock into a soft and a hard limit for this move.
+    // Without "movestogo" we plan for 30 more moves, so the budget shrinks
+    // gradually and the increment is mostly spent as it arrives.
+    void setTimeLimits() {
+        int us = whiteToMove ? 0 : 1;
+        softTimeLimit = hardTimeLimit = 0;
+        
+        if (limits.moveTime > 0) {
+            softTimeLimit = hardTimeLimit = std::max<int64_t>(1, limits.moveTime - MOVE_OVERHEAD);
+        } else if (limits.time[us] > 0) {
+            int64_t available = std::max<int64_t>(1, limits.time[us] - MOVE_OVERHEAD);
+            int movesToGo = limits.movesToGo > 0 ? std::min(limits.movesToGo, 50) : 30;
+            int64_t maximum = available * 8 / 10;
+            
+            softTimeLimit = std::min(available / movesToGo + limits.inc[us] * 3 / 4, maximum);
+            hardTimeLimit = std::min(softTimeLimit * 4, maximum);
+            softTimeLimit = std::max<int64_t>(1, softTimeLimit);
+            hardTimeLimit = std::max<int64_t>(1, hardTimeLimit);
+        }
+    }
+    
+    // Starts our clock once "ponderhit" ends pondering: from then on the search
+    // is on our own time, with the limits it was started with
+    void updatePonderState() {
+        if (waitingForPonderhit && !control->pondering.load(std::memory_order_relaxed)) {
+            waitingForPonderhit = false;
+            ponderhitTime = elapsedTime();
+        }
+    }
+    
+    // Called at every node: stops the search once the node limit is reached and
+    // looks at the clock every 2048 nodes, which keeps the timer off the hot path.
+    // The main thread also reports progress about once a second.
+    void checkLimits() {
+        if (control->stop.load(std::memory_order_relaxed)) {
+            stopped = true;
+        } else if (limits.nodes > 0 && nodes >= limits.nodes) {
+            stopped = true;
+        } else if ((nodes & 2047) == 0) {
+            control->nodes.fetch_add(2048, std::memory_order_relaxed);
+            updatePonderState();
+            
+            int64_t elapsed = elapsedTime();
+            if (hardTimeLimit > 0 && !waitingForPonderhit && elapsed - ponderhitTime >= hardTimeLimit) {
+                stopped = true;
+            }
+            if (control->report && lastInfoTime >= 0 && elapsed - lastInfoTime >= 1000) {
+                lastInfoTime = elapsed;
+                uint64_t total = control->nodes.load(std::memory_order_relaxed);
+                control->report("info nodes " + std::to_string(total)
+                         + " nps " + std::to_string(total * 1000 / std::max<int64_t>(elapsed, 1))
+                         + " hashfull " + std::to_string(hashTable->hashfull())
+                         + " time " + std::to_string(elapsed));
+            }
+        }
+        
+        // Let the other threads know once the main thread runs out of time or nodes
+        if (stopped) {
+            control->stop.store(true, std::memory_order_relaxed);
+        }
+    }
+    
+    // Iterative deepening driver: searches depth 1, 2, ... until a limit is
+    // reached or the main thread signals a stop. The result holds the best move
+    // of the deepest search that finished (or of the interrupted one, when it
+    // already found a better move). Thread 0 is the main thread and the only
+    // one that applies the limits; helpers run until they are stopped.
+    SearchResult iterativeDeepening(int threadId) {
+        nodes = 0;
+        STATS(stats = SearchStats());
+        STATS(StatsTimer timer(stats.searchNanos));
+        stopped = false;
+        searchStart = std::chrono::steady_clock::now();
+        waitingForPonderhit = false;
+        ponderhitTime = 0;
+        lastInfoTime = -1;  // Only the main thread reports
+        
+        int maxDepth = DEFAULT_SEARCH_DEPTH;
+        if (threadId == 0) {
+            setTimeLimits();
+            waitingForPonderhit = limits.ponder;
+            lastInfoTime = 0;
+            if (limits.depth > 0) {
+                maxDepth = std::min(limits.depth, MAX_PLY - 1);
+            } else if (hardTimeLimit > 0 || limits.nodes > 0 || limits.infinite || limits.ponder) {
+                maxDepth = MAX_PLY - 1;
+            }
+        } else {
+            limits.nodes = 0;
+            softTimeLimit = hardTimeLimit = 0;
+            maxDepth = MAX_PLY - 1;
+        }
+        
+        MoveList rootMoves;
+        getAllLegalMoves(rootMoves);
+        
+        lastResult = SearchResult();
+        lastResult.bestMove = rootMoves[0];
+        
+        for (int ply = 0; ply < MAX_PLY; ply++) {
+            killerMoves[ply][0] = killerMoves[ply][1] = NO_MOVE;
+        }
+        nullMoveMinPly = 0;
+        
+        for (int depth = 1; depth <= maxDepth; depth++) {
+            // Helpers skip depths following a per-thread pattern
+            if (threadId > 0) {
+                int i = (threadId - 1) % 20;
+                if (((depth + SKIP_PHASE[i]) / SKIP_SIZE[i]) % 2) {
+                    continue;
+                }
+            }
+            
+            // Search the previous iteration's best move first
+            std::swap(*std::find(rootMoves.begin(), rootMoves.end(), lastResult.bestMove), rootMoves[0]);
+            
+            int alpha = -INF_SCORE;
+            int beta = INF_SCORE;
+            Move iterationBest = NO_MOVE;
+            pvLength[0] = 0;
+            selDepth = 0;
+            
+            for (int i = 0; i < rootMoves.size(); i++) {
+                Move move = rootMoves[i];
+                int score;
+                
+                currentMove[0] = move;
+                makeMove(move);
+                if (i == 0) {
+                    score = -alphaBeta(depth - 1, -beta, -alpha, 1);
+                } else {
+                    score = -alphaBeta(depth - 1, -alpha - 1, -alpha, 1);
+                    if (score > alpha && !stopped) {
+                        score = -alphaBeta(depth - 1, -beta, -alpha, 1);
+                    }
+                }
+                unmakeMove(move);
+                
+                if (stopped) {
+                    break;
+                }
+                if (score > alpha) {
+                    alpha = score;
+                    iterationBest = move;
+                    updatePv(0, move);
+                }
+            }
+            
+            if (iterationBest != NO_MOVE) {
+                lastResult.bestMove = iterationBest;
+                lastResult.score = alpha;
+                lastResult.pvLength = pvLength[0];
+                std::copy(pvTable[0], pvTable[0] + pvLength[0], lastResult.pv);
+            }
+            if (!stopped) {
+                lastResult.depth = depth;
+            }
+            
+            if (threadId == 0 && control->report && iterationBest != NO_MOVE) {
+                int64_t elapsed = elapsedTime();
+                uint64_t total = control->nodes.load(std::memory_order_relaxed) + (nodes & 2047);
+                std::string pv;
+                for (int i = 0; i < lastResult.pvLength; i++) {
+                    pv += " " + moveToString(lastResult.pv[i]);
+                }
+                control->report("info depth " + std::to_string(depth)
+                         + " seldepth " + std::to_string(selDepth)
+                         + " score " + scoreToUci(alpha)
+                         + " nodes " + std::to_string(total)
+                         + " nps " + std::to_string(total * 1000 / std::max<int64_t>(elapsed, 1))
+                         + " hashfull " + std::to_string(hashTable->hashfull())
+                         + " time " + std::to_string(elapsed)
+                         + " pv" + pv);
+            }
+            
+            // Starting another iteration after the soft limit would most likely
+            // be wasted, as it could not finish before the hard limit.
+            updatePonderState();
+            if (stopped || (!waitingForPonderhit && softTimeLimit > 0
+                            && elapsedTime() - ponderhitTime >= softTimeLimit)) {
+                break;
+            }
+        }
+        
+        return lastResult;
+    }
+    
+    // Converts board coordinates (row, col) into algebraic notation (e.g. a1, e4)
+    std::string coordToAlgebraic(int row, int col) {
+        std::string result;
+        result += static_cast<char>('a' + col);
+        result += static_cast<char>('1' + row);
+        return result;
+    }
+    
+public:
+    ChessEngine() {
+        initAttackTables();
+        initZobristKeys();
+        initEvalTables();
+        initSearchTables();
+        initializeBoard();
+    }
+    
+    // Makes the engine search the given table instead of the global one
+    void setTranspositionTable(TranspositionTable& table) {
+        hashTable = &table;
+    }
+    
+    // Forgets the cached evaluations. Needed whenever the evaluation itself
+    // changes: a network is loaded, or NNUE is switched on or off.
+    void clearEvalCache() {
+        std::fill(evalCache.begin(), evalCache.end(), EvalCacheEntry());
+    }
+    
+    // Set up a position from a FEN string. Missing trailing fields keep their
+    // defaults: white to move, castling rights inferred from the piece placement,
+    // no en passant square and a 50-move counter of zero. The fullmove number
+    // is not used.
+    void setPosition(const std::string& fen) {
+        // Reinitialize board first
+        initializeBoard();
+        clearBoard();
+        
+        std::vector<std::string> fenParts;
+        std::istringstream iss(fen);
+        std::string part;
+        
+        while (std::getline(iss, part, ' ')) {
+            fenParts.push_back(part);
+        }
+        
+        if (fenParts.empty()) return;
+        
+        // Parse board position
+        int row = 7;
+        int col = 0;
+        
+        for (char c : fenParts[0]) {
+            if (c == '/') {
+                row--;
+                col = 0;
+            } else if (c >= '1' && c <= '8') {
+                col += (c - '0');
+            } else {
+                int piece = 0;
+                switch (c) {
+                    case 'P': piece = 1; break;  // White pawn
+                    case 'N': piece = 2; break;  // White knight
+                    case 'B': piece = 3; break;  // White bishop
+                    case 'R': piece = 4; break;  // White rook
+                    case 'Q': piece = 5; break;  // White queen
+                    case 'K': piece = 6; break;  // White king
+                    case 'p': piece = 7; break;  // Black pawn
+                    case 'n': piece = 8; break;  // Black knight
+                    case 'b': piece = 9; break;  // Black bishop
+                    case 'r': piece = 10; break; // Black rook
+                    case 'q': piece = 11; break; // Black queen
+                    case 'k': piece = 12; break; // Black king
+                }
+                
+                if (piece != 0 && row >= 0 && row < 8 && col >= 0 && col < 8) {
+                    putPiece(row * 8 + col, piece);
+                }
+                col++;
+            }
+        }
+        
+        // Parse side to move
+        if (fenParts.size() > 1) {
+            whiteToMove = (fenParts[1] == "w");
+        }
+        
+        // Castling rights. The move generator also checks that the king and
+        // rook stand on their original squares, so only the letters matter.
+        if (fenParts.size() > 2) {
+            const std::string& castling = fenParts[2];
+            bool whiteKingside = castling.find('K') != std::string::npos;
+            bool whiteQueenside = castling.find('Q') != std::string::npos;
+            bool blackKingside = castling.find('k') != std::string::npos;
+            bool blackQueenside = castling.find('q') != std::string::npos;
+            
+            whiteKingMoved = !whiteKingside && !whiteQueenside;
+            blackKingMoved = !blackKingside && !blackQueenside;
+            whiteKingsideRookMoved = !whiteKingside;
+            whiteQueensideRookMoved = !whiteQueenside;
+            blackKingsideRookMoved = !blackKingside;
+            blackQueensideRookMoved = !blackQueenside;
+        }
+        
+        // En passant target square, accepted only behind a pawn of the side
+        // that just moved, as makeMove would have left it
+        if (fenParts.size() > 3 && fenParts[3].size() == 2) {
+            int epCol = fenParts[3][0] - 'a';
+            int epRow = fenParts[3][1] - '1';
+            int pawnSquare = (whiteToMove ? 4 : 3) * 8 + epCol;
+            if (epCol >= 0 && epCol < 8 && epRow == (whiteToMove ? 5 : 2)
+                && mailbox[pawnSquare] == (whiteToMove ? 7 : 1)) {
+                enPassantCol = epCol;
+            }
+        }
+        
+        if (fenParts.size() > 4) {
+            halfmoveClock = std::max(0, std::atoi(fenParts[4].c_str()));
+        }
+        
+        computeKey();
+        updateCheckInfo();
+    }
+    
+    // Searches the current position and returns the best move in UCI notation.
+    // With more than one thread this is a Lazy SMP search: every helper runs its
+    // own iterative deepening on a private copy of the engine (position, undo
+    // stack and search state), and the threads cooperate only through the shared
+    // transposition table. Helpers skip some depths depending on their index,
+    // so the threads spread over different depths instead of duplicating work.
+    //
+    // With a control block the search can be stopped from another thread and
+    // reports progress if asked to. An infinite or pondering search does not
+    // return before it is stopped (or the ponder move is played), even when it
+    // runs out of depth.
+    std::string getBestMove(const SearchLimits& searchLimits, int threadCount = 1,
+                            SearchControl* searchControl = nullptr) {
+        MoveList rootMoves;
+        getAllLegalMoves(rootMoves);
+        ponderMove = NO_MOVE;
+        
+        if (rootMoves.empty()) {
+            nodes = 0;
+            return "0000";  // No legal moves
+        }
+        
+        // Won and lost tablebase positions are played by DTZ without a search.
+        // Infinite and pondering searches still search, as they must wait for
+        // "stop" before answering.
+        if (!searchLimits.infinite && !searchLimits.ponder) {
+            int tbScore = 0;
+            Move tbMove = tablebaseRootMove(tbScore);
+            if (tbMove != NO_MOVE) {
+                nodes = 0;
+                lastResult = SearchResult();
+                lastResult.bestMove = tbMove;
+                lastResult.score = tbScore;
+                if (searchControl && searchControl->report) {
+                    searchControl->report("info depth 1 score " + scoreToUci(tbScore) + " nodes 0 pv " + moveToString(tbMove));
+                }
+                return moveToString(tbMove);
+            }
+        }
+        
+        limits = searchLimits;
+        hashTable->newSearch();
+        
+        // The network may have been loaded or switched since the last search
+        resetAccumulators();
+        
+        SearchControl localControl;
+        SearchControl& ctl = searchControl ? *searchControl : localControl;
+        std::vector<ChessEngine> helpers(std::max(threadCount, 1) - 1, *this);
+        std::vector<std::thread> threads;
+        
+        for (size_t i = 0; i < helpers.size(); i++) {
+            helpers[i].control = &ctl;
+            threads.emplace_back([&helpers, i] {
+                helpers[i].iterativeDeepening(int(i) + 1);
+            });
+        }
+        
+        control = &ctl;
+        SearchResult result = iterativeDeepening(0);
+        control = nullptr;
+        
+        while (!ctl.stop.load() && (limits.infinite || ctl.pondering.load())) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        
+        // The main thread owns the limits; once it is done the helpers stop too
+        ctl.stop.store(true, std::memory_order_relaxed);
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+        
+        // Prefer the deepest completed search, the main thread's on a tie
+        for (ChessEngine& helper : helpers) {
+            nodes += helper.nodes;
+            STATS(stats.add(helper.stats));
+            if (helper.lastResult.depth > result.depth && helper.lastResult.bestMove != NO_MOVE) {
+                result = helper.lastResult;
+            }
+        }
+        
+        // The reply we expect is the second move of the principal variation,
+        // or failing that the hash move of the position after our move
+        if (result.pvLength > 1) {
+            ponderMove = result.pv[1];
+        } else {
+            TTData ttData;
+            makeMove(result.bestMove);
+            if (hashTable->probe(key, ttData) && isValidMove(ttData.move)) {
+                ponderMove = ttData.move;
+            }
+            unmakeMove(result.bestMove);
+        }
+
+#if defined(SEARCH_STATS)
+        if (ctl.report) {
+            for (const std::string& line : stats.summary(nodes)) {
+                ctl.report("info string " + line);
+            }
+        }
+#endif
+        
+        lastResult = result;
+        return moveToString(result.bestMove);
+    }
+    
+    // Expected reply to the move returned by the last getBestMove, in UCI
+    // notation, or an empty string if there is none
+    std::string getPonderMove() {
+        return ponderMove == NO_MOVE ? "" : moveToString(ponderMove);
+    }
+    
+    // Score of the move returned by the last getBestMove, from the side to
+    // move's point of view
+    int getScore() const {
+        return lastResult.score;
+    }
+    
+    bool isWhiteToMove() const {
+        return whiteToMove;
+    }
+    
+    bool inCheck() const {
+        return checkers != 0;
+    }
+    
+    // Whether the game is drawn by threefold repetition or the 50-move rule
+    bool isDrawn() const {
+        return isDraw(0);
+    }
+    
+    // Seeds the random choice of book and random moves, for reproducible games
+    void seed(uint32_t value) {
+        rng.seed(value);
+    }
+    
+    // A uniformly random legal move in UCI notation, or an empty string if
+    // there is none
+    std::string getRandomMove() {
+        MoveList moves;
+        getAllLegalMoves(moves);
+        if (moves.empty()) {
+            return "";
+        }
+        return moveToString(moves[std::uniform_int_distribution<int>(0, moves.size() - 1)(rng)]);
+    }
+    
+    // Writes the current position with the last getBestMove result as a
+    // TRAINING_RECORD_SIZE byte record (see the layout there), leaving the
+    // game result for the caller. Positions in check and positions whose best
+    // move is a capture or promotion are not quiet enough to train a static
+    // evaluation on; for those nothing is written and false is returned.
+    bool packTrainingRecord(uint8_t* record) const {
+        if (checkers || lastResult.bestMove == NO_MOVE || isNoisy(lastResult.bestMove)) {
+            return false;
+        }
+        
+        std::memset(record, 0, TRAINING_RECORD_SIZE);
+        for (int i = 0; i < 8; i++) {
+            record[i] = uint8_t(occupied >> (8 * i));
+        }
+        int index = 0;
+        for (Bitboard pieces = occupied; pieces; index++) {
+            record[8 + index / 2] |= uint8_t(mailbox[popLsb(pieces)] << (4 * (index % 2)));
+        }
+        
+        uint16_t score = uint16_t(int16_t(lastResult.score));
+        record[24] = uint8_t(score);
+        record[25] = uint8_t(score >> 8);
+        record[26] = uint8_t(lastResult.bestMove.data);
+        record[27] = uint8_t(lastResult.bestMove.data >> 8);
+        record[29] = uint8_t((whiteToMove ? 0 : 1) | (castlingRights() << 1));
+        record[30] = enPassantCol >= 0 ? uint8_t(enPassantCol) : 0xFF;
+        record[31] = uint8_t(std::min(halfmoveClock, 255));
+        return true;
+    }
+    
+    // Castling rights still held as bits: K = 1, Q = 2, k = 4, q = 8. A right
+    // counts only while its king and rook are still in place.
+    int castlingRights() const {
+        int rights = 0;
+        if (!whiteKingMoved && mailbox[4] == 6) {
+            if (!whiteKingsideRookMoved && mailbox[7] == 4) rights |= 1;
+            if (!whiteQueensideRookMoved && mailbox[0] == 4) rights |= 2;
+        }
+        if (!blackKingMoved && mailbox[60] == 12) {
+            if (!blackKingsideRookMoved && mailbox[63] == 10) rights |= 4;
+            if (!blackQueensideRookMoved && mailbox[56] == 10) rights |= 8;
+        }
+        return rights;
+    }
+    
+    // Hash of the current position as defined by the Polyglot book format
+    uint64_t polyglotKey() const {
+        uint64_t result = 0;
+        for (int sq = 0; sq < 64; sq++) {
+            int piece = mailbox[sq];
+            if (piece != 0) {
+                int kind = 2 * ((piece - 1) % 6) + (piece <= 6 ? 1 : 0);
+                result ^= POLYGLOT_RANDOM[64 * kind + sq];
+            }
+        }
+        
+        int rights = castlingRights();
+        for (int i = 0; i < 4; i++) {
+            if (rights & (1 << i)) {
+                result ^= POLYGLOT_RANDOM[POLYGLOT_CASTLING + i];
+            }
+        }
+        
+        // The en passant file is hashed only if a pawn can actually capture
+        if (enPassantCol >= 0) {
+            int row = whiteToMove ? 4 : 3;
+            int pawn = whiteToMove ? 1 : 7;
+            if ((enPassantCol > 0 && mailbox[row * 8 + enPassantCol - 1] == pawn)
+                || (enPassantCol < 7 && mailbox[row * 8 + enPassantCol + 1] == pawn)) {
+                result ^= POLYGLOT_RANDOM[POLYGLOT_EN_PASSANT + enPassantCol];
+            }
+        }
+        
+        if (whiteToMove) {
+            result ^= POLYGLOT_RANDOM[POLYGLOT_TURN];
+        }
+        return result;
+    }
+    
+    // A weighted random book move for the current position in UCI notation,
+    // or an empty string if the book has none
+    std::string getBookMove(const PolyglotBook& book) {
+        uint16_t bookMove = book.probe(polyglotKey(), uint32_t(rng()));
+        if (bookMove == 0) {
+            return "";
+        }
+        
+        int to = bookMove & 63;
+        int from = (bookMove >> 6) & 63;
+        int promotion = (bookMove >> 12) & 7;
+        
+        // Match against the legal moves, which also rejects entries that
+        // belong to another position with a colliding key
+        MoveList moves;
+        getAllLegalMoves(moves);
+        for (Move move : moves) {
+            // Polyglot writes castling as the king capturing its own rook
+            int moveTo = move.to();
+            if (move.kind() == CASTLING) {
+                moveTo = move.to() > move.from() ? move.from() + 3 : move.from() - 4;
+            }
+            int movePromotion = move.kind() == PROMOTION ? move.promotionType() - 1 : 0;
+            
+            if (move.from() == from && moveTo == to && movePromotion == promotion) {
+                return moveToString(move);
+            }
+        }
+        return "";
+    }
+    
+    // Converts a move into UCI coordinate notation (e.g. e2e4, e7e8q)
+    std::string moveToString(Move move) {
+        std::string result = coordToAlgebraic(move.from() / 8, move.from() % 8)
+                           + coordToAlgebraic(move.to() / 8, move.to() % 8);
+        if (move.kind() == PROMOTION) {
+            result += "nbrq"[move.promotionType() - 2];
+        }
+        return result;
+    }
+    
+    // Converts a legal move into standard algebraic notation (e.g. Nbd7, exd6,
+    // e8=Q+, O-O), disambiguating by file, then rank, then both
+    std::string moveToSan(Move move) {
+        int from = move.from();
+        int to = move.to();
+        int type = (mailbox[from] - 1) % 6 + 1;
+        bool capture = mailbox[to] != 0 || move.kind() == EN_PASSANT;
+        std::string result;
+        
+        if (move.kind() == CASTLING) {
+            result = to > from ? "O-O" : "O-O-O";
+        } else if (type == 1) {
+            if (capture) {
+                result += static_cast<char>('a' + from % 8);
+                result += 'x';
+            }
+            result += coordToAlgebraic(to / 8, to % 8);
+            if (move.kind() == PROMOTION) {
+                result += '=';
+                result += "NBRQ"[move.promotionType() - 2];
+            }
+        } else {
+            result += " PNBRQK"[type];
+            
+            // Other pieces of the same kind that can reach the same square
+            MoveList moves;
+            getAllLegalMoves(moves);
+            bool ambiguous = false, sameFile = false, sameRank = false;
+            for (Move other : moves) {
+                if (other.to() == to && other.from() != from && mailbox[other.from()] == mailbox[from]) {
+                    ambiguous = true;
+                    sameFile |= other.from() % 8 == from % 8;
+                    sameRank |= other.from() / 8 == from / 8;
+                }
+            }
+            if (ambiguous && (!sameFile || sameRank)) {
+                result += static_cast<char>('a' + from % 8);
+            }
+            if (ambiguous && sameFile) {
+                result += static_cast<char>('1' + from / 8);
+            }
+            
+            if (capture) {
+                result += 'x';
+            }
+            result += coordToAlgebraic(to / 8, to % 8);
+        }
+        
+        makeMove(move);
+        if (checkers) {
+            MoveList replies;
+            getAllLegalMoves(replies);
+            result += replies.empty() ? '#' : '+';
+        }
+        unmakeMove(move);
+        return result;
+    }
+    
+    // Standard algebraic notation of a move given in UCI notation, or an
+    // empty string if it is not a legal move in the current position
+    std::string toSan(const std::string& moveStr) {
+        MoveList moves;
+        getAllLegalMoves(moves);
+        for (Move move : moves) {
+            if (moveToString(move) == moveStr) {
+                return moveToSan(move);
+            }
+        }
+        return "";
+    }
+    
+    // Make a move using a string in algebraic coordinate notation, e.g. "e2e4" or "e7e8n".
+    // The string is matched against the generated moves so castling, en passant
+    // and promotion flags are set correctly; unknown moves are ignored.
+    void makeMove(const std::string& moveStr) {
+        if (moveStr.length() < 4) return;
+        
+        MoveList moves;
+        getAllLegalMoves(moves);
+        
+        for (Move move : moves) {
+            if (moveToString(move) == moveStr
+                || (move.kind() == PROMOTION && move.promotionType() == 5 && moveStr.length() == 4
+                    && moveToString(move).compare(0, 4, moveStr) == 0)) {
+                // Game moves are never taken back, so once the stack's game portion is
+                // full it is cut down to the entries isDraw can still reach: those
+                // since the last capture, pawn move or null move, and at most 100,
+                // as the 50-move rule decides the game before any older one matters.
+                if (undoCount >= MAX_GAME_PLY) {
+                    int kept = std::min({ halfmoveClock, pliesFromNull, 100 });
+                    std::copy(undoStack + undoCount - kept, undoStack + undoCount, undoStack);
+                    undoCount = kept;
+                }
+                
+                makeMove(move);
+                resetAccumulators();
+                return;
+            }
+        }
+    }
+    
+    // -------------------------
+    // New public helper methods for search
+    // -------------------------
+    
+    // Fills moves with all legal moves of the side to move
+    void getLegalMoves(MoveList& moves) {
+        getAllLegalMoves(moves);
+    }
+    
+    // Counts the leaf nodes of the legal move tree to the given depth. The
+    // generator is fully legal, so the last ply is just the size of the move list.
+    uint64_t perft(int depth) {
+        if (depth == 0) {
+            return 1;
+        }
+        
+        MoveList moves;
+        getAllLegalMoves(moves);
+        if (depth == 1) {
+            return moves.size();
+        }
+        
+        uint64_t count = 0;
+        for (Move move : moves) {
+            makeMove(move);
+            count += perft(depth - 1);
+            unmakeMove(move);
+        }
+        return count;
+    }
+    
+    // Zobrist key of the current position
+    uint64_t getKey() const {
+        return key;
+    }
+    
+    // Number of positions visited by the last search
+    uint64_t getNodes() const {
+        return nodes;
+    }
+
+#if defined(SEARCH_STATS)
+    // Counters of the last search, summed over its threads
+    const SearchStats& getStats() const {
+        return stats;
+    }
+#endif    
+    // Applies a move (as produced by getLegalMoves) to the board.
+    void applyMove(Move move) {
+        makeMove(move);
+    }
+    
+    // Takes back a move applied with applyMove, restoring the previous position.
+    void undoMove(Move move) {
+        unmakeMove(move);
+    }
+    
+    // Tapered evaluation from white's point of view: material and piece-square
+    // sums, maintained by makeMove/unmakeMove, plus the pawn structure, which
+    // usually comes straight from the pawn hash table.
+    int evaluateBoard() {
+        const PawnEntry& pawns = probePawnTable();
+        int mg = psqtMg + pawns.mg;
+        int eg = psqtEg + pawns.eg;
+        int mgPhase = std::min(phase, MAX_PHASE);
+        return (mg * mgPhase + eg * (MAX_PHASE - mgPhase)) / MAX_PHASE;
+    }
+    
+    // Static evaluation used by the search, from the side to move's point of
+    // view: the NNUE network when one is loaded and enabled, otherwise
+    // evaluateBoard(). Results are cached by position key, since transpositions
+    // and re-searches evaluate the same positions again.
+    int evaluate() {
+        STATS(StatsTimer timer(stats.evalNanos));
+        EvalCacheEntry& cached = evalCache[key & (EVAL_CACHE_SIZE - 1)];
+        if (cached.key == key) {
+            return cached.score;
+        }
+        
+        int score;
+        if (nnueNetwork.active()) {
+            score = evaluateNNUE();
+        } else {
+            int eval = evaluateBoard();
+            score = whiteToMove ? eval : -eval;
+        }
+        
+        cached.key = key;
+        cached.score = score;
+        return score;
+    }
+    
+    // Quiescence search: at the end of the main search only captures (and queen
+    // promotions) are searched until the position is quiet, so leaf scores are
+    // never taken in the middle of an exchange. The side to move may "stand
+    // pat" on the static evaluation instead of capturing, unless it is in
+    // check: then every evasion is searched, and having none is mate.
+    template <Color Us>
+    int quiescence(int alpha, int beta, int ply) {
+        nodes++;
+        STATS(stats.qsearchNodes++);
+        pvLength[ply] = ply;
+        selDepth = std::max(selDepth, ply);
+        checkLimits();
+        if (stopped) {
+            return 0;
+        }
+        
+        bool inCheck = checkers != 0;
+        int standPat = -INF_SCORE;
+        
+        if (!inCheck || ply >= MAX_PLY - 1) {
+            standPat = evaluate();
+            if (standPat >= beta || ply >= MAX_PLY - 1) {
+                return standPat;
+            }
+            if (standPat > alpha) {
+                alpha = standPat;
+            }
+        }
+        
+        // The captures-only picker already drops captures that lose material by SEE
+        MovePicker<Us> picker = inCheck ? MovePicker<Us>(*this, NO_MOVE, ply) : MovePicker<Us>(*this);
+        int bestScore = standPat;
+        Move move;
+        while ((move = picker.next()) != NO_MOVE) {
+            // Evasions are searched without pruning
+            if (!inCheck) {
+                if (move.kind() == PROMOTION) {
+                    if (move.promotionType() != 5) {
+                        continue;  // Under-promotions are left to the main search
+                    }
+                } else {
+                    // Delta pruning: hopeless even if the captured piece comes for free
+                    int captured = (move.kind() == EN_PASSANT) ? 1 : mailbox[move.to()];
+                    if (standPat + SEE_VALUES[captured] + DELTA_MARGIN <= alpha) {
+                        continue;
+                    }
+                }
+            }
+            
+            makeMove<Us>(move);
+            int score = -quiescence<~Us>(-beta, -alpha, ply + 1);
+            unmakeMove<Us>(move);
+            
+            if (stopped) {
+                return 0;
+            }
+            if (score > bestScore) {
+                bestScore = score;
+                if (score > alpha) {
+                    alpha = score;
+                    if (alpha >= beta) {
+                        break;
+                    }
+                }
+            }
+        }
+        
+        if (inCheck && bestScore == -INF_SCORE) {
+            return -MATE_SCORE + ply;
+        }
+        return bestScore;
+    }
+    
+    // Captures and pawn moves reset the 50-move counter
+    bool isZeroing(Move move) const {
+        int piece = mailbox[move.from()];
+        return mailbox[move.to()] != 0 || move.kind() == EN_PASSANT || piece == 1 || piece == 7;
+    }
+    
+    // Whether the tablebases may hold the position: few enough pieces, and
+    // no castling rights, which the tables do not encode
+    bool inTablebaseRange() const {
+        return tablebases.maxPieces() > 0 && popCount(occupied) <= tablebases.maxPieces()
+            && castlingRights() == 0;
+    }
+    
+    // WDL value of the position. Where the side to move has a winning capture
+    // the generator stores whatever compresses best, and where a capture draws
+    // it may store a loss, so captures (and for DTZ probes, pawn moves) are
+    // searched and the best of their values and the table's is the result.
+    // state is set to TB_ZEROING_BEST_MOVE when one of those moves is best.
+    int tablebaseSearch(bool checkZeroingMoves, TBProbeState& state) {
+        int bestValue = WDL_LOSS;
+        int value;
+        
+        MoveList moves;
+        getAllLegalMoves(moves);
+        int moveCount = 0;
+        
+        for (Move move : moves) {
+            bool capture = mailbox[move.to()] != 0 || move.kind() == EN_PASSANT;
+            if (!capture && (!checkZeroingMoves || !isZeroing(move))) {
+                continue;
+            }
+            moveCount++;
+            
+            makeMove(move);
+            value = -tablebaseSearch(false, state);
+            unmakeMove(move);
+            
+            if (state == TB_FAIL) {
+                return WDL_DRAW;
+            }
+            if (value > bestValue) {
+                bestValue = value;
+                if (value >= WDL_WIN) {
+                    state = TB_ZEROING_BEST_MOVE;
+                    return value;
+                }
+            }
+        }
+        
+        // When every legal move was searched the table value is not needed
+        // (it is wrong for positions with en passant rights, for one)
+        bool noMoreMoves = moveCount > 0 && moveCount == moves.size();
+        if (noMoreMoves) {
+            value = bestValue;
+        } else {
+            value = tablebases.probeTable(TB_WDL, pieceBB, whiteToMove, WDL_DRAW, state);
+            if (state == TB_FAIL) {
+                return WDL_DRAW;
+            }
+        }
+        
+        if (bestValue >= value) {
+            state = bestValue > WDL_DRAW || noMoreMoves ? TB_ZEROING_BEST_MOVE : TB_OK;
+            return bestValue;
+        }
+        state = TB_OK;
+        return value;
+    }
+    
+    int probeWDL(TBProbeState& state) {
+        state = TB_OK;
+        return tablebaseSearch(false, state);
+    }
     
-    void initializeBoard() {
-        // Initialize empty board
-        board = std::vector<std::vector<int>>(8, std::vector<int>(8, 0));
+    // Distance to zeroing in plies, positive when the side to move wins and
+    // negative when it loses; beyond +-100 the result is a draw by the
+    // 50-move rule when counted from a zero 50-move counter. May be one ply
+    // too long.
+    int probeDTZ(TBProbeState& state) {
+        state = TB_OK;
+        int wdl = tablebaseSearch(true, state);
+        if (state == TB_FAIL || wdl == WDL_DRAW) {
+            return 0;  // DTZ tables do not store draws
+        }
+        if (state == TB_ZEROING_BEST_MOVE) {
+            return dtzBeforeZeroing(wdl);
+        }
         
-        // Set up pawns
-        for (int col = 0; col < 8; col++) {
-            board[1][col] = 1; // white pawn
-            board[6][col] = 7; // black pawn
+        int dtz = tablebases.probeTable(TB_DTZ, pieceBB, whiteToMove, wdl, state);
+        if (state == TB_FAIL) {
+            return 0;
+        }
+        if (state != TB_CHANGE_STM) {
+            return (dtz + 100 * (wdl == WDL_BLESSED_LOSS || wdl == WDL_CURSED_WIN)) * (wdl > 0 ? 1 : -1);
         }
         
-        // Set up other pieces
-        board[0][0] = 4; board[0][7] = 4; // white rooks
-        board[0][1] = 2; board[0][6] = 2; // white knights
-        board[0][2] = 3; board[0][5] = 3; // white bishops
-        board[0][3] = 5; // white queen
-        board[0][4] = 6; // white king
-        
-        board[7][0] = 10; board[7][7] = 10; // black rooks
-        board[7][1] = 8;  board[7][6] = 8;  // black knights
-        board[7][2] = 9;  board[7][5] = 9;  // black bishops
-        board[7][3] = 11; // black queen
-        board[7][4] = 12; // black king
+        // The table stores the other side to move: take the best DTZ after
+        // one move, in the direction of the WDL result
+        int minDtz = 0xFFFF;
+        MoveList moves;
+        getAllLegalMoves(moves);
+        for (Move move : moves) {
+            bool zeroing = isZeroing(move);
+            
+            makeMove(move);
+            // A zeroing move's DTZ is that of the position before it
+            dtz = zeroing ? -dtzBeforeZeroing(tablebaseSearch(false, state)) : -probeDTZ(state);
+            
+            if (dtz == 1 && checkers) {
+                MoveList replies;
+                getAllLegalMoves(replies);
+                if (replies.empty()) {
+                    minDtz = 1;  // Mate
+                }
+            }
+            if (!zeroing) {
+                dtz += dtz > 0 ? 1 : dtz < 0 ? -1 : 0;
+            }
+            if (dtz < minDtz && (dtz > 0) == (wdl > 0) && dtz != 0) {
+                minDtz = dtz;
+            }
+            unmakeMove(move);
+            
+            if (state == TB_FAIL) {
+                return 0;
+            }
+        }
+        return minDtz == 0xFFFF ? -1 : minDtz;
+    }
+    
+    // The root move that wins fastest (or, when every move loses, loses
+    // slowest) by DTZ, with score set to its value. Returns NO_MOVE when the
+    // position is not in the tablebases or can be drawn; drawn positions are
+    // searched, with WDL probes scoring the moves.
+    Move tablebaseRootMove(int& score) {
+        if (!inTablebaseRange()) {
+            return NO_MOVE;
+        }
         
-        whiteToMove = true;
-        whiteKingMoved = false;
-        blackKingMoved = false;
-        whiteKingsideRookMoved = false;
-        whiteQueensideRookMoved = false;
-        blackKingsideRookMoved = false;
-        blackQueensideRookMoved = false;
-        enPassantCol = -1;
+        const int MAX_DTZ = 1 << 18;
+        MoveList moves;
+        getAllLegalMoves(moves);
+        Move bestMove = NO_MOVE;
+        int bestRank = -INT_MAX;
+        int bestDtz = 0;
         
-        // Initialize random number generator
-        unsigned seed = std::chrono::system_clock::now().time_since_epoch().count();
-        rng = std::mt19937(seed);
+        for (Move move : moves) {
+            bool zeroing = isZeroing(move);
+            TBProbeState state;
+            int dtz;
+            
+            makeMove(move);
+            if (zeroing) {
+                dtz = dtzBeforeZeroing(-probeWDL(state));
+            } else {
+                dtz = -probeDTZ(state);
+                dtz += dtz > 0 ? 1 : dtz < 0 ? -1 : 0;
+            }
+            if (dtz == 2 && checkers) {
+                MoveList replies;
+                getAllLegalMoves(replies);
+                if (replies.empty()) {
+                    dtz = 1;  // Mate
+                }
+            }
+            unmakeMove(move);
+            
+            if (state == TB_FAIL) {
+                return NO_MOVE;
+            }
+            
+            int rank = dtz > 0 ? MAX_DTZ - dtz : dtz < 0 ? -MAX_DTZ - dtz : 0;
+            if (rank > bestRank) {
+                bestRank = rank;
+                bestMove = move;
+                bestDtz = dtz;
+            }
+        }
+        
+        if (bestDtz == 0) {
+            return NO_MOVE;
+        }
+        
+        // Results the 50-move rule turns into draws score like cursed wins
+        // and blessed losses
+        int distance = std::abs(bestDtz) + halfmoveClock;
+        score = bestDtz > 0 ? (distance > 100 ? 2 : TB_WIN_SCORE)
+                            : (distance > 100 ? -2 : -TB_WIN_SCORE);
+        return bestMove;
     }
     
-    bool isWhitePiece(int piece) {
-        return piece >= 1 && piece <= 6;
+    // Principal variation search. Returns a score from the point-of-view of the side
+    // to move: the first move is searched with the full (alpha, beta) window and
+    // the rest with a null window, re-searching only moves that beat alpha.
+    // Us is the side to move.
+    //
+    // Outside the principal variation the search is selective: null move and
+    // reverse futility pruning cut nodes that are clearly good enough, and
+    // futility pruning and late move reductions spend less on quiet moves that
+    // are unlikely to matter. Moves that give check are extended by a ply.
+    template <Color Us>
+    int alphaBeta(int depth, int alpha, int beta, int ply) {
+        nodes++;
+        pvLength[ply] = ply;
+        selDepth = std::max(selDepth, ply);
+        checkLimits();
+        if (stopped || isDraw(ply)) {
+            return 0;
+        }
+        
+        if (depth == 0 || ply >= MAX_PLY - 1) {
+            return quiescence<Us>(alpha, beta, ply);
+        }
+        
+        // A stored result that is deep enough and whose bound settles the window
+        // ends the search here; otherwise its move is still the best first guess.
+        TTData ttData;
+        Move ttMove = NO_MOVE;
+        STATS(stats.ttProbes++);
+        if (hashTable->probe(key, ttData)) {
+            STATS(stats.ttHits++);
+            int ttScore = scoreFromTT(ttData.score, ply);
+            ttMove = ttData.move;
+            
+            if (ttData.depth >= depth
+                && (ttData.bound == BOUND_EXACT
+                    || (ttData.bound == BOUND_LOWER && ttScore >= beta)
+                    || (ttData.bound == BOUND_UPPER && ttScore <= alpha))) {
+                return ttScore;
+            }
+        }
+        
+        // A tablebase position gets its exact value. The tables assume a zero
+        // 50-move counter, so they are only probed right after a capture or
+        // pawn move. Wins are lower and losses
+        // upper bounds (the mate itself is still to be found): they end the
+        // search when they settle the window, and otherwise bound the score
+        // of a PV node, whose moves are searched for the shortest mate.
+        int originalAlpha = alpha;
+        int maxScore = INF_SCORE;
+        int tbScore = -INF_SCORE;
+        if (halfmoveClock == 0 && inTablebaseRange()) {
+            TBProbeState state;
+            int wdl = probeWDL(state);
+            if (state != TB_FAIL) {
+                int score = wdl < -1 ? -TB_WIN_SCORE + ply : wdl > 1 ? TB_WIN_SCORE - ply : 2 * wdl;
+                int bound = wdl < -1 ? BOUND_UPPER : wdl > 1 ? BOUND_LOWER : BOUND_EXACT;
+                if (bound == BOUND_EXACT || (bound == BOUND_LOWER ? score >= beta : score <= alpha)) {
+                    hashTable->store(key, NO_MOVE, scoreToTT(score, ply),
+                                             std::min(depth + 6, MAX_PLY - 1), bound);
+                    return score;
+                }
+                if (beta - alpha > 1) {
+                    if (bound == BOUND_LOWER) {
+                        tbScore = score;
+                        alpha = std::max(alpha, score);
+                    } else {
+                        maxScore = score;
+                    }
+                }
+            }
+        }
+        
+        bool pvNode = beta - alpha > 1;
+        bool inCheck = checkers != 0;
+        int staticEval = inCheck ? -INF_SCORE : evaluate();
+        
+        // Reverse futility pruning: so far above beta that no quiet reply at
+        // this small depth is expected to bring the score back
+        if (searchOptions.reverseFutilityPruning && !pvNode && !inCheck && depth <= RFP_MAX_DEPTH
+            && std::abs(beta) < TB_WIN_SCORE - MAX_PLY && staticEval - RFP_MARGIN * depth >= beta) {
+            return staticEval;
+        }
+        
+        // Null move pruning: if passing still fails high on a reduced search,
+        // a real move would too, unless the position is zugzwang. Without
+        // pieces other than pawns zugzwang is common, so the null move is not
+        // tried there, and two null moves are never made in a row.
+        if (searchOptions.nullMovePruning && !pvNode && !inCheck && depth >= 3 && staticEval >= beta
+            && ply >= nullMoveMinPly && currentMove[ply - 1] != NO_MOVE
+            && (colorBB[Us] & ~pieceBB[Us * 6 + 1] & ~pieceBB[Us * 6 + 6])) {
+            int reduction = NULL_MOVE_REDUCTION + depth / 4;
+            
+            currentMove[ply] = NO_MOVE;
+            makeNullMove<Us>();
+            int score = -alphaBeta<~Us>(std::max(depth - 1 - reduction, 0), -beta, -beta + 1, ply + 1);
+            unmakeNullMove<Us>();
+            
+            if (stopped) {
+                return 0;
+            }
+            if (score >= beta) {
+                // A mate found after passing is not proven for a real move
+                if (score >= TB_WIN_SCORE - MAX_PLY) {
+                    score = beta;
+                }
+                if (depth < NULL_MOVE_VERIFY_DEPTH || nullMoveMinPly > 0) {
+                    return score;
+                }
+                
+                // Verification search, with null moves off for the next plies
+                nullMoveMinPly = ply + 3 * (depth - reduction) / 4;
+                int verified = alphaBeta<Us>(depth - reduction, beta - 1, beta, ply);
+                nullMoveMinPly = 0;
+                if (verified >= beta) {
+                    return score;
+                }
+            }
+        }
+        
+        // Futility pruning: close to the leaves, quiet moves cannot make up for
+        // a static evaluation this far below alpha
+        bool futile = searchOptions.futilityPruning && !pvNode && !inCheck && depth <= FUTILITY_MAX_DEPTH
+                   && std::abs(alpha) < TB_WIN_SCORE - MAX_PLY
+                   && staticEval + FUTILITY_MARGIN * depth <= alpha;
+        
+        MovePicker<Us> picker(*this, ttMove, ply);
+        Move quietsTried[64];
+        int quietCount = 0;
+        int moveCount = 0;
+        
+        int bestScore = tbScore;
+        Move bestMove = NO_MOVE;
+        Move move;
+        while ((move = picker.next()) != NO_MOVE) {
+            bool quiet = !isNoisy(move);
+            int score;
+            
+            makeMove<Us>(move);
+            bool givesCheck = checkers != 0;
+            
+            // Moves that give check are never pruned, and at least one move is
+            // searched so that mate and stalemate are still recognized
+            if (futile && quiet && !givesCheck && moveCount > 0) {
+                unmakeMove<Us>(move);
+                continue;
+            }
+            
+            currentMove[ply] = move;
+            int newDepth = depth - 1 + (searchOptions.checkExtensions && givesCheck);
+            
+            if (moveCount++ == 0) {
+                score = -alphaBeta<~Us>(newDepth, -beta, -alpha, ply + 1);
+            } else {
+                // Late move reductions: quiet moves ordered late rarely raise
+                // alpha, so they are searched shallower first, and again at full
+                // depth only if they do
+                int reduction = 0;
+                if (searchOptions.lateMoveReductions && depth >= LMR_MIN_DEPTH && moveCount > LMR_MIN_MOVES
+                    && quiet && !inCheck && !givesCheck) {
+                    reduction = lmrReductions[std::min(depth, 63)][std::min(moveCount, 63)] - pvNode;
+                    reduction = std::max(0, std::min(reduction, newDepth - 1));
+                }
+                
+                score = -alphaBeta<~Us>(newDepth - reduction, -alpha - 1, -alpha, ply + 1);
+                if (reduction > 0 && score > alpha) {
+                    score = -alphaBeta<~Us>(newDepth, -alpha - 1, -alpha, ply + 1);
+                }
+                if (score > alpha && score < beta) {
+                    score = -alphaBeta<~Us>(newDepth, -beta, -alpha, ply + 1);
+                }
+            }
+            unmakeMove<Us>(move);
+            
+            if (stopped) {
+                return 0;
+            }
+            if (score > bestScore) {
+                bestScore = score;
+                if (score > alpha) {
+                    alpha = score;
+                    bestMove = move;
+                    updatePv(ply, move);
+                    if (alpha >= beta) {
+                        // Beta cutoff: remember quiet moves that refute this node
+                        STATS(stats.cutoffs++);
+                        STATS(stats.firstMoveCutoffs += moveCount == 1);
+                        if (quiet) {
+                            updateQuietStats(move, quietsTried, quietCount, depth, ply);
+                        }
+                        break;
+                    }
+                }
+            }
+            
+            if (quiet && quietCount < 64) {
+                quietsTried[quietCount++] = move;
+            }
+        }
+        
+        // No legal moves: checkmate, scored by distance from the root so that
+        // shorter mates are preferred, or stalemate
+        if (moveCount == 0) {
+            return checkers ? -MATE_SCORE + ply : 0;
+        }
+        bestScore = std::min(bestScore, maxScore);
+        
+        int bound = bestScore >= beta ? BOUND_LOWER
+                  : bestScore > originalAlpha ? BOUND_EXACT : BOUND_UPPER;
+        hashTable->store(key, bestMove, scoreToTT(bestScore, ply), depth, bound);
+        
+        return bestScore;
     }
     
-    bool isBlackPiece(int piece) {
-        return piece >= 7 && piece <= 12;
+    int alphaBeta(int depth, int alpha, int beta, int ply) {
+        return whiteToMove ? alphaBeta<WHITE>(depth, alpha, beta, ply) : alphaBeta<BLACK>(depth, alpha, beta, ply);
     }
+};
+
+// Prints elapsed time and speed in the format shared by "go perft" and "bench"
+void printSpeed(uint64_t nodes, std::chrono::steady_clock::time_point start) {
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start).count();
+    uint64_t nps = nodes * 1000 / std::max<uint64_t>(elapsed, 1);
     
-    bool isEnemyPiece(int piece) {
-        if (whiteToMove) {
-            return isBlackPiece(piece);
-        } else {
-            return isWhitePiece(piece);
-        }
+    std::cout << "Nodes searched: " << nodes << std::endl;
+    std::cout << "Time (ms): " << elapsed << std::endl;
+    std::cout << "Nodes/second: " << nps << std::endl;
+}
+
+// Runs perft from the engine's current position, printing the node count below
+// each root move ("divide") followed by the total.
+void runPerft(ChessEngine& engine, int depth) {
+    auto start = std::chrono::steady_clock::now();
+    uint64_t total = 0;
+    
+    MoveList moves;
+    engine.getLegalMoves(moves);
+    
+    for (Move move : moves) {
+        engine.applyMove(move);
+        uint64_t count = engine.perft(depth - 1);
+        engine.undoMove(move);
+        
+        std::cout << engine.moveToString(move) << ": " << count << std::endl;
+        total += count;
     }
     
-    bool isOwnPiece(int piece) {
-        if (whiteToMove) {
-            return isWhitePiece(piece);
-        } else {
-            return isBlackPiece(piece);
+    std::cout << std::endl;
+    printSpeed(total, start);
+}
+
+// Fixed positions searched by "bench"
+const char* const BENCH_POSITIONS[] = {
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+    "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+    "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+    "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+    "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+    "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",
+    "r1bqkb1r/pppp1ppp/2n2n2/4p3/2B1P3/5N2/PPPP1PPP/RNBQK2R w KQkq - 4 4",
+    "2r3k1/pp3ppp/4p3/3pP3/3P4/P4N2/1P3PPP/2R3K1 b - - 0 25",
+    "8/8/4k3/3p4/3P4/4K3/8/8 w - - 0 1",
+    "6k1/5ppp/8/8/8/8/5PPP/3R2K1 w - - 0 1",
+    "r3k2r/7r/6N1/8/8/8/8/4K3 w kq - 0 1",  // Nxh8 must take away black's kingside castling
+};
+
+// Moves of a game longer than the game history an engine keeps (MAX_GAME_PLY
+// plies): a pair of pawn moves every 90 plies, with the knights shuffling
+// back and forth in between. It ends just after the history is cut down, in a
+// position that last occurred before the cut, so the bench node count
+// depends on the repetitions from before the cut still being found.
+std::vector<std::string> benchLongGame() {
+    const char* const PAWN_MOVES[][2] = {
+        { "a2a3", "a7a6" }, { "a3a4", "a6a5" }, { "b2b3", "b7b6" }, { "b3b4", "b6b5" },
+        { "c2c3", "c7c6" }, { "c3c4", "c6c5" }, { "d2d3", "d7d6" }, { "d3d4", "d6d5" },
+        { "e2e3", "e7e6" }, { "e3e4", "e6e5" }, { "h2h3", "h7h6" }, { "h3h4", "h6h5" },
+    };
+    const char* const KNIGHT_MOVES[] = { "g1f3", "g8f6", "f3g1", "f6g8" };
+    
+    std::vector<std::string> moves;
+    for (const auto& pawnMoves : PAWN_MOVES) {
+        moves.push_back(pawnMoves[0]);
+        moves.push_back(pawnMoves[1]);
+        for (int ply = 0; ply < 88 && moves.size() < size_t(MAX_GAME_PLY) + 2; ply++) {
+            moves.push_back(KNIGHT_MOVES[ply % 4]);
         }
     }
+    return moves;
+}
+
+// Searches every bench position to a fixed depth and reports the combined
+// node count and speed. With one thread the search is deterministic, so the
+// node total is a signature of the search and the speed can be compared between
+// builds. With more threads the total time is the time-to-depth, which shows
+// how well the parallel search scales against a single-threaded run.
+void runBench(int depth, int threads) {
+    auto start = std::chrono::steady_clock::now();
+    uint64_t total = 0;
+    int index = 1;
+    
+    // Start from an empty hash table so runs are comparable
+    transpositionTable.clear();
+    STATS(SearchStats totalStats);
+    
+    auto search = [&](ChessEngine& engine) {
+        SearchLimits limits;
+        limits.depth = depth;
+        std::string bestMove = engine.getBestMove(limits, threads);
+        
+        std::cout << "Position " << index++ << ": bestmove " << bestMove
+                  << " nodes " << engine.getNodes() << std::endl;
+        total += engine.getNodes();
+        STATS(totalStats.add(engine.getStats()));
+    };
+    
+    for (const char* fen : BENCH_POSITIONS) {
+        ChessEngine engine;
+        engine.setPosition(fen);
+        search(engine);
+    }
     
-    // Populates moves with all pseudolegal moves (note that moves leaving king in check are not removed)
-    void getAllLegalMoves(std::vector<std::pair<std::pair<int, int>, std::pair<int, int>>>& moves) {
-        moves.clear();
+    ChessEngine longGame;
+    for (const std::string& move : benchLongGame()) {
+        longGame.makeMove(move);
+    }
+    search(longGame);
+    
+    std::cout << std::endl;
+    printSpeed(total, start);
+
+#if defined(SEARCH_STATS)
+    for (const std::string& line : totalStats.summary(total)) {
+        std::cout << line << std::endl;
+    }
+#endif
+}
+
+// One position of an EPD test suite with the operations the runner checks.
+// Moves are kept as the suite writes them, in SAN or in UCI notation.
+struct EPDRecord {
+    std::string fen;
+    std::string id;
+    std::vector<std::string> bestMoves;   // "bm": one of these should be played
+    std::vector<std::string> avoidMoves;  // "am": none of these should be played
+};
+
+// Parses an EPD line: four FEN fields followed by semicolon-terminated
+// operations, e.g. `... w - - bm Qg6; id "WAC.001";`. Move clocks after the
+// FEN fields are accepted too. Returns false for blank and comment lines.
+bool parseEPD(const std::string& line, EPDRecord& record) {
+    record = EPDRecord();
+    std::istringstream iss(line);
+    std::string field;
+    
+    for (int i = 0; i < 4 && iss >> field; i++) {
+        record.fen += (i ? " " : "") + field;
+    }
+    if (record.fen.empty() || record.fen[0] == '#') {
+        return false;
+    }
+    while (iss >> std::ws && iss.peek() >= '0' && iss.peek() <= '9') {
+        iss >> field;
+        record.fen += " " + field;
+    }
+    
+    std::string operation;
+    while (std::getline(iss, operation, ';')) {
+        std::istringstream operands(operation);
+        std::string opcode, operand;
+        operands >> opcode;
         
-        for (int row = 0; row < 8; row++) {
-            for (int col = 0; col < 8; col++) {
-                int piece = board[row][col];
-                
-                // Skip empty squares and squares with enemy pieces
-                if (piece == 0 || !isOwnPiece(piece)) {
+        if (opcode == "id") {
+            std::getline(operands >> std::ws, record.id);
+            record.id.erase(std::remove(record.id.begin(), record.id.end(), '"'), record.id.end());
+        } else if (opcode == "bm" || opcode == "am") {
+            std::vector<std::string>& moves = opcode == "bm" ? record.bestMoves : record.avoidMoves;
+            while (operands >> operand) {
+                moves.push_back(operand);
+            }
+        }
+    }
+    return true;
+}
+
+// True if the move, given both in UCI notation and in SAN, is in the list.
+// Check marks, annotations and the '=' of promotions are ignored.
+bool epdListsMove(const std::vector<std::string>& moves, const std::string& uciMove, const std::string& sanMove) {
+    auto normalize = [](std::string move) {
+        move.erase(std::remove_if(move.begin(), move.end(), [](char c) {
+            return c == '+' || c == '#' || c == '!' || c == '?' || c == '=';
+        }), move.end());
+        return move;
+    };
+    
+    for (const std::string& move : moves) {
+        if (move == uciMove || normalize(move) == normalize(sanMove)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Runs an EPD test suite for analysis and regression checks. The file is
+// streamed: each worker owns an engine and reads the next line when it is
+// done with the previous one, so positions are analyzed in parallel by
+// single-threaded searches that share the transposition table. A line is
+// printed as each position completes (so they may come out of order), then
+// the number of positions solved, positions/second and the combined node
+// count and speed. Returns false if the file cannot be opened.
+bool runEPD(const std::string& path, int workers, const SearchLimits& limits) {
+    std::ifstream file(path);
+    if (!file) {
+        std::cout << "Cannot open EPD file " << path << std::endl;
+        return false;
+    }
+    
+    auto start = std::chrono::steady_clock::now();
+    std::mutex fileMutex;
+    int lineNumber = 0;
+    std::atomic<int> positions{0}, checked{0}, solved{0};
+    std::atomic<uint64_t> totalNodes{0};
+    
+    transpositionTable.clear();
+    
+    std::vector<ChessEngine> engines(workers);
+    std::vector<std::thread> threads;
+    
+    for (ChessEngine& engine : engines) {
+        threads.emplace_back([&] {
+            EPDRecord record;
+            std::string line;
+            
+            while (true) {
+                int number;
+                {
+                    std::lock_guard<std::mutex> lock(fileMutex);
+                    if (!std::getline(file, line)) {
+                        return;
+                    }
+                    number = ++lineNumber;
+                }
+                if (!parseEPD(line, record)) {
                     continue;
                 }
                 
-                // Normalize piece value (1-6 for both colors)
-                int normalizedPiece = (piece > 6) ? piece - 6 : piece;
+                engine.setPosition(record.fen);
+                std::string sanMove = "none";
+                std::string bestMove = engine.getBestMove(limits);
+                if (bestMove != "0000") {
+                    sanMove = engine.toSan(bestMove);
+                }
+                positions++;
+                totalNodes += engine.getNodes();
                 
-                switch (normalizedPiece) {
-                    case 1: // Pawn
-                        getPawnMoves(row, col, moves);
-                        break;
-                    case 2: // Knight
-                        getKnightMoves(row, col, moves);
-                        break;
-                    case 3: // Bishop
-                        getBishopMoves(row, col, moves);
-                        break;
-                    case 4: // Rook
-                        getRookMoves(row, col, moves);
+                std::string result = "Line " + std::to_string(number)
+                                   + (record.id.empty() ? "" : " " + record.id)
+                                   + ": bestmove " + sanMove;
+                if (!record.bestMoves.empty() || !record.avoidMoves.empty()) {
+                    bool ok = (record.bestMoves.empty() || epdListsMove(record.bestMoves, bestMove, sanMove))
+                           && !epdListsMove(record.avoidMoves, bestMove, sanMove);
+                    checked++;
+                    solved += ok;
+                    result += ok ? " solved" : " failed";
+                }
+                sendLine(result + " nodes " + std::to_string(engine.getNodes()));
+            }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start).count();
+    
+    std::cout << std::endl;
+    std::cout << "Solved: " << solved << "/" << checked << std::endl;
+    std::cout << "Positions: " << positions << std::endl;
+    std::cout << "Positions/second: " << positions * 1000.0 / std::max<int64_t>(elapsed, 1) << std::endl;
+    printSpeed(totalNodes, start);
+    return true;
+}
+
+// Runs self-play games for training data (see TRAINING_RECORD_SIZE for the
+// format), appending the records of finished games to the file at path.
+// Progress is printed every SELFPLAY_REPORT_GAMES games. Returns false if
+// the file cannot be opened.
+bool runSelfplay(const std::string& path, int games, int workers, uint64_t nodes, int randomPlies, uint32_t seed) {
+    std::ofstream file(path, std::ios::binary | std::ios::app);
+    if (!file) {
+        std::cout << "Cannot open output file " << path << std::endl;
+        return false;
+    }
+    
+    const int SELFPLAY_REPORT_GAMES = 100;
+    auto start = std::chrono::steady_clock::now();
+    std::mutex fileMutex;
+    std::atomic<int> nextGame{0}, finishedGames{0};
+    std::atomic<uint64_t> positions{0}, totalNodes{0};
+    
+    transpositionTable.clear();
+    
+    auto positionsPerSecond = [&] {
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start).count();
+        return positions * 1000 / std::max<uint64_t>(elapsed, 1);
+    };
+    
+    std::vector<std::thread> threads;
+    for (int worker = 0; worker < workers; worker++) {
+        threads.emplace_back([&] {
+            std::vector<uint8_t> buffer;
+            std::vector<uint8_t> game;
+            buffer.reserve(SELFPLAY_BUFFER_SIZE + SELFPLAY_MAX_PLIES * TRAINING_RECORD_SIZE);
+            
+            SearchLimits limits;
+            limits.nodes = nodes;
+            
+            auto flush = [&] {
+                std::lock_guard<std::mutex> lock(fileMutex);
+                file.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+                buffer.clear();
+            };
+            
+            for (int index; (index = nextGame++) < games;) {
+                ChessEngine engine;
+                engine.seed(seed + uint32_t(index));
+                game.clear();
+                
+                bool playable = true;
+                for (int ply = 0; ply < randomPlies && playable; ply++) {
+                    std::string move = engine.getRandomMove();
+                    playable = !move.empty();
+                    if (playable) {
+                        engine.makeMove(move);
+                    }
+                }
+                if (!playable) {
+                    continue;  // The random moves ended the game
+                }
+                
+                int result = 1;
+                for (int ply = 0; ply < SELFPLAY_MAX_PLIES; ply++) {
+                    if (engine.isDrawn()) {
                         break;
-                    case 5: // Queen (rook + bishop moves)
-                        getBishopMoves(row, col, moves);
-                        getRookMoves(row, col, moves);
+                    }
+                    
+                    std::string move = engine.getBestMove(limits);
+                    totalNodes += engine.getNodes();
+                    if (move == "0000") {
+                        // Checkmate or stalemate
+                        if (engine.inCheck()) {
+                            result = engine.isWhiteToMove() ? 0 : 2;
+                        }
                         break;
-                    case 6: // King
-                        getKingMoves(row, col, moves);
+                    }
+                    
+                    // A mate or tablebase win found by the search decides the game
+                    int score = engine.getScore();
+                    if (std::abs(score) >= TB_WIN_SCORE - MAX_PLY) {
+                        result = (score > 0) == engine.isWhiteToMove() ? 2 : 0;
                         break;
+                    }
+                    
+                    game.resize(game.size() + TRAINING_RECORD_SIZE);
+                    if (!engine.packTrainingRecord(&game[game.size() - TRAINING_RECORD_SIZE])) {
+                        game.resize(game.size() - TRAINING_RECORD_SIZE);
+                    }
+                    engine.makeMove(move);
+                }
+                
+                for (size_t offset = 0; offset < game.size(); offset += TRAINING_RECORD_SIZE) {
+                    game[offset + TRAINING_RESULT_OFFSET] = uint8_t(result);
+                }
+                buffer.insert(buffer.end(), game.begin(), game.end());
+                if (buffer.size() >= SELFPLAY_BUFFER_SIZE) {
+                    flush();
                 }
+                
+                positions += game.size() / TRAINING_RECORD_SIZE;
+                int finished = ++finishedGames;
+                if (finished % SELFPLAY_REPORT_GAMES == 0) {
+                    sendLine("Games " + std::to_string(finished) + " positions " + std::to_string(positions)
+                             + " positions/second " + std::to_string(positionsPerSecond()));
+                }
+            }
+            flush();
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    
+    std::cout << std::endl;
+    std::cout << "Games: " << finishedGames << std::endl;
+    std::cout << "Positions: " << positions << std::endl;
+    std::cout << "Positions/second: " << positionsPerSecond() << std::endl;
+    printSpeed(totalNodes, start);
+    return true;
+}
+
+// The Texel tuner fits the handcrafted evaluation weights to the game results
+// of training positions. Each position is reduced to the weights its
+// evaluation adds up and how often, white minus black, so that
+//   eval = phase * sum(count * mg weight) + (1 - phase) * sum(count * eg weight)
+// and the tuner minimizes the mean of (result - sigmoid(K * eval))^2 by
+// gradient descent with Adam, after fitting K to the starting weights.
+//
+// A table of weights applies to the middlegame, the endgame or, for the
+// piece-square tables shared by both phases, to both.
+enum TunePhase { TUNE_MG, TUNE_EG, TUNE_BOTH };
+
+struct TuneTable {
+    const char* name;
+    const int* values;
+    int size;
+    TunePhase phase;
+};
+
+enum TuneTableId {
+    TUNE_MATERIAL_MG, TUNE_MATERIAL_EG,
+    TUNE_PAWN_MG, TUNE_PAWN_EG, TUNE_KNIGHT, TUNE_BISHOP, TUNE_ROOK, TUNE_QUEEN, TUNE_KING_MG, TUNE_KING_EG,
+    TUNE_PASSED_MG, TUNE_PASSED_EG, TUNE_ISOLATED_MG, TUNE_ISOLATED_EG, TUNE_DOUBLED_MG, TUNE_DOUBLED_EG,
+    TUNE_SHELTER_NEAR, TUNE_SHELTER_FAR, TUNE_SHELTER_OPEN,
+    TUNE_TABLE_COUNT
+};
+
+// The tuned weights, in the order they are written out
+const TuneTable TUNE_TABLES[TUNE_TABLE_COUNT] = {
+    { "MATERIAL_MG", MATERIAL_MG, 7, TUNE_MG },
+    { "MATERIAL_EG", MATERIAL_EG, 7, TUNE_EG },
+    { "PAWN_MG", PAWN_MG, 64, TUNE_MG },
+    { "PAWN_EG", PAWN_EG, 64, TUNE_EG },
+    { "KNIGHT_PST", KNIGHT_PST, 64, TUNE_BOTH },
+    { "BISHOP_PST", BISHOP_PST, 64, TUNE_BOTH },
+    { "ROOK_PST", ROOK_PST, 64, TUNE_BOTH },
+    { "QUEEN_PST", QUEEN_PST, 64, TUNE_BOTH },
+    { "KING_MG", KING_MG, 64, TUNE_MG },
+    { "KING_EG", KING_EG, 64, TUNE_EG },
+    { "PASSED_PAWN_MG", PASSED_PAWN_MG, 8, TUNE_MG },
+    { "PASSED_PAWN_EG", PASSED_PAWN_EG, 8, TUNE_EG },
+    { "ISOLATED_PAWN_MG", &ISOLATED_PAWN_MG, 1, TUNE_MG },
+    { "ISOLATED_PAWN_EG", &ISOLATED_PAWN_EG, 1, TUNE_EG },
+    { "DOUBLED_PAWN_MG", &DOUBLED_PAWN_MG, 1, TUNE_MG },
+    { "DOUBLED_PAWN_EG", &DOUBLED_PAWN_EG, 1, TUNE_EG },
+    { "SHELTER_PAWN_NEAR", &SHELTER_PAWN_NEAR, 1, TUNE_MG },
+    { "SHELTER_PAWN_FAR", &SHELTER_PAWN_FAR, 1, TUNE_MG },
+    { "SHELTER_OPEN_FILE", &SHELTER_OPEN_FILE, 1, TUNE_MG }
+};
+
+// Piece-square table of each piece type in each phase, as in PST_MG/PST_EG
+const TuneTableId TUNE_PST_MG[7] = { TUNE_MATERIAL_MG, TUNE_PAWN_MG, TUNE_KNIGHT, TUNE_BISHOP, TUNE_ROOK, TUNE_QUEEN, TUNE_KING_MG };
+const TuneTableId TUNE_PST_EG[7] = { TUNE_MATERIAL_EG, TUNE_PAWN_EG, TUNE_KNIGHT, TUNE_BISHOP, TUNE_ROOK, TUNE_QUEEN, TUNE_KING_EG };
+
+const int TUNE_BLOCK_SIZE = 256;      // Positions evaluated per pass of the inner loops
+const int TUNE_LOAD_RECORDS = 65536;  // Records read from the file at a time
+const int TUNE_REPORT_EPOCHS = 10;    // Progress is printed and written this often
+const double TUNE_BETA1 = 0.9;        // Adam decay rates of the mean and variance
+const double TUNE_BETA2 = 0.999;
+
+// One worker's share of the training positions as flat arrays. Position i
+// has result[i] and phase[i] and uses the weights index[j] with count[j]
+// for j from begin[i] up to begin[i + 1].
+struct TuningShard {
+    std::vector<float> result;  // Game result for white: 0, 0.5 or 1
+    std::vector<float> phase;   // Middlegame share of the evaluation, 0 to 1
+    std::vector<uint64_t> begin{0};
+    std::vector<uint16_t> index;
+    std::vector<int8_t> count;
+};
+
+// Appends a training record (see TRAINING_RECORD_SIZE) to the shard, with the
+// weights indexed from offset[table]. counts is a scratch vector of one zero
+// per weight. Returns false, adding nothing, for a malformed record.
+bool addTuningPosition(const uint8_t* record, const int* offset, std::vector<int>& counts, TuningShard& shard) {
+    Bitboard occupancy = 0;
+    for (int i = 0; i < 8; i++) {
+        occupancy |= Bitboard(record[i]) << (8 * i);
+    }
+    if (popCount(occupancy) > 32 || record[TRAINING_RESULT_OFFSET] > 2) {
+        return false;
+    }
+    
+    // At most three weights per piece and 15 pawn structure terms
+    uint16_t used[3 * 32 + 15];
+    int usedCount = 0;
+    auto add = [&](int weight, int amount) {
+        if (counts[weight] == 0) {
+            used[usedCount++] = uint16_t(weight);
+        }
+        counts[weight] += amount;
+    };
+    
+    Bitboard pawns[2] = { 0, 0 };
+    Bitboard kings[2] = { 0, 0 };
+    int phase = 0;
+    int index = 0;
+    for (Bitboard pieces = occupancy; pieces; index++) {
+        int sq = popLsb(pieces);
+        int piece = (record[8 + index / 2] >> (4 * (index % 2))) & 15;
+        if (piece < 1 || piece > 12) {
+            for (int i = 0; i < usedCount; i++) {
+                counts[used[i]] = 0;
             }
+            return false;
+        }
+        int color = (piece > 6) ? 1 : 0;
+        int type = piece - 6 * color;
+        int sign = color ? -1 : 1;
+        int tableIndex = color ? sq : sq ^ 56;
+        
+        add(offset[TUNE_MATERIAL_MG] + type, sign);
+        add(offset[TUNE_MATERIAL_EG] + type, sign);
+        add(offset[TUNE_PST_MG[type]] + tableIndex, sign);
+        if (TUNE_PST_EG[type] != TUNE_PST_MG[type]) {
+            add(offset[TUNE_PST_EG[type]] + tableIndex, sign);
+        }
+        phase += PHASE_WEIGHT[type];
+        if (type == 1) {
+            pawns[color] |= squareBB(sq);
+        } else if (type == 6) {
+            kings[color] |= squareBB(sq);
+        }
+    }
+    
+    PawnTerms terms;
+    countPawnTerms(pawns, kings, terms);
+    for (int rank = 0; rank < 8; rank++) {
+        add(offset[TUNE_PASSED_MG] + rank, terms.passed[rank]);
+        add(offset[TUNE_PASSED_EG] + rank, terms.passed[rank]);
+    }
+    add(offset[TUNE_ISOLATED_MG], terms.isolated);
+    add(offset[TUNE_ISOLATED_EG], terms.isolated);
+    add(offset[TUNE_DOUBLED_MG], terms.doubled);
+    add(offset[TUNE_DOUBLED_EG], terms.doubled);
+    add(offset[TUNE_SHELTER_NEAR], terms.shelterNear);
+    add(offset[TUNE_SHELTER_FAR], terms.shelterFar);
+    add(offset[TUNE_SHELTER_OPEN], terms.shelterOpen);
+    
+    // Weights that cancel out, like the kings' material, are left out
+    for (int i = 0; i < usedCount; i++) {
+        uint16_t weight = used[i];
+        if (counts[weight] != 0) {
+            shard.index.push_back(weight);
+            shard.count.push_back(int8_t(counts[weight]));
+            counts[weight] = 0;
         }
     }
+    shard.result.push_back(record[TRAINING_RESULT_OFFSET] * 0.5f);
+    shard.phase.push_back(float(std::min(phase, MAX_PHASE)) / MAX_PHASE);
+    shard.begin.push_back(shard.index.size());
+    return true;
+}
+
+// Sums the squared error of the shard's positions for the given middlegame
+// and endgame value of each weight (zero where a weight does not apply).
+// When gradMg and gradEg are given, adds sum(e * s * (1 - s) * d eval / d w)
+// to them, where s is the predicted and e the residual score, split into the
+// middlegame and endgame parts of each weight.
+double tuneShard(const TuningShard& shard, const float* weightMg, const float* weightEg, float k,
+                 double* gradMg, double* gradEg) {
+    float eval[TUNE_BLOCK_SIZE];
+    float delta[TUNE_BLOCK_SIZE];
+    double error = 0;
     
-    void getPawnMoves(int row, int col, std::vector<std::pair<std::pair<int, int>, std::pair<int, int>>>& moves) {
-        int direction = whiteToMove ? 1 : -1;
-        int startRow = whiteToMove ? 1 : 6;
+    size_t positions = shard.result.size();
+    for (size_t first = 0; first < positions; first += TUNE_BLOCK_SIZE) {
+        int size = int(std::min<size_t>(TUNE_BLOCK_SIZE, positions - first));
+        const float* result = &shard.result[first];
+        const float* phase = &shard.phase[first];
         
-        // Forward one square
-        if (row + direction >= 0 && row + direction < 8 && board[row + direction][col] == 0) {
-            moves.push_back({{row, col}, {row + direction, col}});
-            
-            // Forward two squares from starting position
-            if (row == startRow && board[row + 2 * direction][col] == 0) {
-                moves.push_back({{row, col}, {row + 2 * direction, col}});
+        for (int i = 0; i < size; i++) {
+            float mg = 0, eg = 0;
+            for (uint64_t j = shard.begin[first + i]; j < shard.begin[first + i + 1]; j++) {
+                mg += shard.count[j] * weightMg[shard.index[j]];
+                eg += shard.count[j] * weightEg[shard.index[j]];
             }
+            eval[i] = phase[i] * mg + (1 - phase[i]) * eg;
         }
         
-        // Captures diagonally
-        for (int dc : {-1, 1}) {
-            if (col + dc >= 0 && col + dc < 8 && row + direction >= 0 && row + direction < 8) {
-                // Normal capture
-                if (board[row + direction][col + dc] != 0 && isEnemyPiece(board[row + direction][col + dc])) {
-                    moves.push_back({{row, col}, {row + direction, col + dc}});
-                }
-                
-                // En passant capture
-                if (enPassantCol == col + dc) {
-                    int epRow = whiteToMove ? 5 : 2;
-                    if (row == epRow - direction) {
-                        moves.push_back({{row, col}, {epRow, col + dc}});
-                    }
-                }
+        // Dense over the block, so it vectorizes
+        float blockError = 0;
+        for (int i = 0; i < size; i++) {
+            float predicted = 1 / (1 + std::exp(-k * eval[i]));
+            float residual = result[i] - predicted;
+            blockError += residual * residual;
+            delta[i] = residual * predicted * (1 - predicted);
+        }
+        error += blockError;
+        
+        if (!gradMg) {
+            continue;
+        }
+        for (int i = 0; i < size; i++) {
+            float deltaMg = delta[i] * phase[i];
+            float deltaEg = delta[i] - deltaMg;
+            for (uint64_t j = shard.begin[first + i]; j < shard.begin[first + i + 1]; j++) {
+                gradMg[shard.index[j]] += deltaMg * shard.count[j];
+                gradEg[shard.index[j]] += deltaEg * shard.count[j];
             }
         }
     }
+    return error;
+}
+
+// Writes the weights as a header of constants that replace the defaults
+// when the engine is built with -DEVAL_WEIGHTS (see the evaluation tables)
+bool writeTunedWeights(const std::string& path, const std::vector<double>& weights, const int* offset,
+                       uint64_t positions, int epochs) {
+    std::ofstream file(path);
+    if (!file) {
+        return false;
+    }
     
-    void getKnightMoves(int row, int col, std::vector<std::pair<std::pair<int, int>, std::pair<int, int>>>& moves) {
-        const int knight_moves[8][2] = {
-            {-2, -1}, {-2, 1}, {-1, -2}, {-1, 2},
-            {1, -2},  {1, 2},  {2, -1},  {2, 1}
-        };
+    file << "// Evaluation weights tuned by \"nexa --tune\" for " << epochs << " epochs on " << positions << " positions\n";
+    for (int table = 0; table < TUNE_TABLE_COUNT; table++) {
+        const TuneTable& tune = TUNE_TABLES[table];
+        auto value = [&](int i) { return int(std::lround(weights[offset[table] + i])); };
         
-        for (int i = 0; i < 8; i++) {
-            int newRow = row + knight_moves[i][0];
-            int newCol = col + knight_moves[i][1];
-            
-            if (newRow >= 0 && newRow < 8 && newCol >= 0 && newCol < 8) {
-                if (board[newRow][newCol] == 0 || isEnemyPiece(board[newRow][newCol])) {
-                    moves.push_back({{row, col}, {newRow, newCol}});
+        if (tune.size == 1) {
+            file << "const int " << tune.name << " = " << value(0) << ";\n";
+        } else if (tune.size < 64) {
+            file << "const int " << tune.name << "[" << tune.size << "] = {";
+            for (int i = 0; i < tune.size; i++) {
+                file << (i ? ", " : " ") << value(i);
+            }
+            file << " };\n";
+        } else {
+            // Laid out as the board is drawn, like the tables in this file
+            file << "\nconst int " << tune.name << "[64] = {\n";
+            for (int row = 0; row < 8; row++) {
+                file << "  ";
+                for (int col = 0; col < 8; col++) {
+                    file << (col ? "," : " ") << std::setw(3) << value(row * 8 + col);
                 }
+                file << (row < 7 ? ",\n" : "\n");
             }
+            file << "};\n";
+        }
+        if (tune.size == 64 && table + 1 < TUNE_TABLE_COUNT && TUNE_TABLES[table + 1].size < 64) {
+            file << "\n";
+        }
+    }
+    return bool(file);
+}
+
+// Tunes the evaluation weights on the training records in the file at path
+// (see TRAINING_RECORD_SIZE) for the given number of epochs, each a full
+// pass over all positions, and writes them to output every
+// TUNE_REPORT_EPOCHS epochs and at the end. The positions are split evenly
+// between the workers, which load their share and compute its error and
+// gradient in parallel. Returns false if a file cannot be opened or holds
+// no positions.
+bool runTune(const std::string& path, const std::string& output, int workers, int epochs, double rate) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file) {
+        std::cout << "Cannot open training data " << path << std::endl;
+        return false;
+    }
+    uint64_t records = uint64_t(file.tellg()) / TRAINING_RECORD_SIZE;
+    file.close();
+    
+    initEvalTables();
+    int offset[TUNE_TABLE_COUNT + 1] = { 0 };
+    for (int table = 0; table < TUNE_TABLE_COUNT; table++) {
+        offset[table + 1] = offset[table] + TUNE_TABLES[table].size;
+    }
+    const int weightCount = offset[TUNE_TABLE_COUNT];
+    
+    std::vector<double> weights(weightCount);
+    for (int table = 0; table < TUNE_TABLE_COUNT; table++) {
+        for (int i = 0; i < TUNE_TABLES[table].size; i++) {
+            weights[offset[table] + i] = TUNE_TABLES[table].values[i];
         }
     }
     
-    void getBishopMoves(int row, int col, std::vector<std::pair<std::pair<int, int>, std::pair<int, int>>>& moves) {
-        const int directions[4][2] = {
-            {-1, -1}, {-1, 1}, {1, -1}, {1, 1}
-        };
-        
-        for (int i = 0; i < 4; i++) {
-            int dr = directions[i][0];
-            int dc = directions[i][1];
+    auto start = std::chrono::steady_clock::now();
+    auto elapsedMs = [&] {
+        return std::max<int64_t>(1, std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start).count());
+    };
+    
+    // Each worker reads and converts its own range of records
+    std::vector<TuningShard> shards(workers);
+    std::vector<std::thread> threads;
+    for (int worker = 0; worker < workers; worker++) {
+        threads.emplace_back([&, worker] {
+            uint64_t first = records * worker / workers;
+            uint64_t last = records * (worker + 1) / workers;
+            TuningShard& shard = shards[worker];
+            shard.result.reserve(last - first);
+            shard.phase.reserve(last - first);
+            shard.begin.reserve(last - first + 1);
             
-            for (int distance = 1; distance < 8; distance++) {
-                int newRow = row + dr * distance;
-                int newCol = col + dc * distance;
-                
-                if (newRow < 0 || newRow >= 8 || newCol < 0 || newCol >= 8) {
+            std::ifstream input(path, std::ios::binary);
+            input.seekg(first * TRAINING_RECORD_SIZE);
+            std::vector<uint8_t> buffer(TUNE_LOAD_RECORDS * TRAINING_RECORD_SIZE);
+            std::vector<int> counts(weightCount, 0);
+            for (uint64_t next = first; next < last;) {
+                uint64_t size = std::min<uint64_t>(TUNE_LOAD_RECORDS, last - next);
+                if (!input.read(reinterpret_cast<char*>(buffer.data()), size * TRAINING_RECORD_SIZE)) {
                     break;
                 }
-                
-                if (board[newRow][newCol] == 0) {
-                    moves.push_back({{row, col}, {newRow, newCol}});
-                } else if (isEnemyPiece(board[newRow][newCol])) {
-                    moves.push_back({{row, col}, {newRow, newCol}});
-                    break;
-                } else {
-                    break;
+                for (uint64_t i = 0; i < size; i++) {
+                    addTuningPosition(&buffer[i * TRAINING_RECORD_SIZE], offset, counts, shard);
                 }
+                next += size;
             }
-        }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
     }
     
-    void getRookMoves(int row, int col, std::vector<std::pair<std::pair<int, int>, std::pair<int, int>>>& moves) {
-        const int directions[4][2] = {
-            {-1, 0}, {1, 0}, {0, -1}, {0, 1}
-        };
+    uint64_t positions = 0;
+    uint64_t entries = 0;
+    for (const TuningShard& shard : shards) {
+        positions += shard.result.size();
+        entries += shard.index.size();
+    }
+    std::cout << "Positions: " << positions << " (" << records - positions << " skipped), "
+              << entries / std::max<uint64_t>(positions, 1) << " weights each, loaded in "
+              << elapsedMs() << " ms" << std::endl;
+    if (positions == 0) {
+        return false;
+    }
+    
+    // Mean squared error of all positions, and its gradient when asked for
+    std::vector<float> weightMg(weightCount), weightEg(weightCount);
+    std::vector<std::vector<double>> gradMg(workers, std::vector<double>(weightCount));
+    std::vector<std::vector<double>> gradEg(workers, std::vector<double>(weightCount));
+    auto meanError = [&](float k, bool gradient) {
+        for (int table = 0; table < TUNE_TABLE_COUNT; table++) {
+            TunePhase phase = TUNE_TABLES[table].phase;
+            for (int i = offset[table]; i < offset[table + 1]; i++) {
+                weightMg[i] = phase != TUNE_EG ? float(weights[i]) : 0;
+                weightEg[i] = phase != TUNE_MG ? float(weights[i]) : 0;
+            }
+        }
         
-        for (int i = 0; i < 4; i++) {
-            int dr = directions[i][0];
-            int dc = directions[i][1];
-            
-            for (int distance = 1; distance < 8; distance++) {
-                int newRow = row + dr * distance;
-                int newCol = col + dc * distance;
-                
-                if (newRow < 0 || newRow >= 8 || newCol < 0 || newCol >= 8) {
-                    break;
+        std::vector<double> errors(workers);
+        std::vector<std::thread> threads;
+        for (int worker = 0; worker < workers; worker++) {
+            threads.emplace_back([&, worker] {
+                if (gradient) {
+                    std::fill(gradMg[worker].begin(), gradMg[worker].end(), 0.0);
+                    std::fill(gradEg[worker].begin(), gradEg[worker].end(), 0.0);
                 }
-                
-                if (board[newRow][newCol] == 0) {
-                    moves.push_back({{row, col}, {newRow, newCol}});
-                } else if (isEnemyPiece(board[newRow][newCol])) {
-                    moves.push_back({{row, col}, {newRow, newCol}});
-                    break;
-                } else {
+                errors[worker] = tuneShard(shards[worker], weightMg.data(), weightEg.data(), k,
+                                           gradient ? gradMg[worker].data() : nullptr,
+                                           gradient ? gradEg[worker].data() : nullptr);
+            });
+        }
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+        
+        double error = 0;
+        for (double workerError : errors) {
+            error += workerError;
+        }
+        return error / positions;
+    };
+    
+    // Fit the sigmoid's scale to the starting weights, one digit at a time
+    float k = std::log(10.0f) / 400;
+    double error = meanError(k, false);
+    for (float step = 1e-3f; step > 1e-6f; step /= 10) {
+        for (float direction : { step, -step }) {
+            while (k + direction > 0) {
+                double candidate = meanError(k + direction, false);
+                if (candidate >= error) {
                     break;
                 }
+                k += direction;
+                error = candidate;
             }
         }
     }
+    std::cout << "K: " << k << ", starting error: " << std::setprecision(8) << error << std::endl;
     
-    void getKingMoves(int row, int col, std::vector<std::pair<std::pair<int, int>, std::pair<int, int>>>& moves) {
-        // Normal king moves
-        const int directions[8][2] = {
-            {-1, -1}, {-1, 0}, {-1, 1}, {0, -1},
-            {0, 1}, {1, -1}, {1, 0}, {1, 1}
-        };
+    std::vector<double> mean(weightCount), variance(weightCount);
+    double beta1Power = 1, beta2Power = 1;
+    auto tuneStart = std::chrono::steady_clock::now();
+    for (int epoch = 1; epoch <= epochs; epoch++) {
+        error = meanError(k, true);
+        beta1Power *= TUNE_BETA1;
+        beta2Power *= TUNE_BETA2;
         
-        for (int i = 0; i < 8; i++) {
-            int newRow = row + directions[i][0];
-            int newCol = col + directions[i][1];
-            
-            if (newRow >= 0 && newRow < 8 && newCol >= 0 && newCol < 8) {
-                if (board[newRow][newCol] == 0 || isEnemyPiece(board[newRow][newCol])) {
-                    moves.push_back({{row, col}, {newRow, newCol}});
+        for (int table = 0; table < TUNE_TABLE_COUNT; table++) {
+            TunePhase phase = TUNE_TABLES[table].phase;
+            for (int i = offset[table]; i < offset[table + 1]; i++) {
+                double sum = 0;
+                for (int worker = 0; worker < workers; worker++) {
+                    sum += (phase != TUNE_EG ? gradMg[worker][i] : 0) + (phase != TUNE_MG ? gradEg[worker][i] : 0);
                 }
+                double gradient = -2 * k * sum / positions;
+                mean[i] = TUNE_BETA1 * mean[i] + (1 - TUNE_BETA1) * gradient;
+                variance[i] = TUNE_BETA2 * variance[i] + (1 - TUNE_BETA2) * gradient * gradient;
+                weights[i] -= rate * (mean[i] / (1 - beta1Power)) / (std::sqrt(variance[i] / (1 - beta2Power)) + 1e-8);
             }
         }
         
-        // Castling
-        if (whiteToMove) {
-            if (!whiteKingMoved && row == 0 && col == 4) {
-                // Kingside castling
-                if (!whiteKingsideRookMoved && board[0][5] == 0 && board[0][6] == 0 && board[0][7] == 4) {
-                    moves.push_back({{row, col}, {0, 6}});
-                }
-                // Queenside castling
-                if (!whiteQueensideRookMoved && board[0][3] == 0 && board[0][2] == 0 && board[0][1] == 0 && board[0][0] == 4) {
-                    moves.push_back({{row, col}, {0, 2}});
-                }
-            }
-        } else {
-            if (!blackKingMoved && row == 7 && col == 4) {
-                // Kingside castling
-                if (!blackKingsideRookMoved && board[7][5] == 0 && board[7][6] == 0 && board[7][7] == 10) {
-                    moves.push_back({{row, col}, {7, 6}});
-                }
-                // Queenside castling
-                if (!blackQueensideRookMoved && board[7][3] == 0 && board[7][2] == 0 && board[7][1] == 0 && board[7][0] == 10) {
-                    moves.push_back({{row, col}, {7, 2}});
-                }
+        if (epoch % TUNE_REPORT_EPOCHS == 0 || epoch == epochs) {
+            auto elapsed = std::max<int64_t>(1, std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - tuneStart).count());
+            std::cout << "Epoch " << epoch << " error " << std::setprecision(8) << error
+                      << " positions/second " << uint64_t(positions * epoch * 1000.0 / elapsed) << std::endl;
+            if (!writeTunedWeights(output, weights, offset, positions, epoch)) {
+                std::cout << "Cannot write " << output << std::endl;
+                return false;
             }
         }
     }
     
-    // Makes a move given by a pair-of-pairs { {fromRow, fromCol}, {toRow, toCol} }
-    void makeMove(const std::pair<std::pair<int, int>, std::pair<int, int>>& move) {
-        int fromRow = move.first.first;
-        int fromCol = move.first.second;
-        int toRow = move.second.first;
-        int toCol = move.second.second;
-        
-        int piece = board[fromRow][fromCol];
-        
-        // Reset en passant
-        enPassantCol = -1;
-        
-        // Check for pawn double move (for en passant)
-        if ((piece == 1 || piece == 7) && std::abs(fromRow - toRow) == 2) {
-            enPassantCol = fromCol;
-        }
-        
-        // Check for en passant capture
-        if ((piece == 1 || piece == 7) && fromCol != toCol && board[toRow][toCol] == 0) {
-            // This is an en passant capture
-            int capturedRow = fromRow;
-            board[capturedRow][toCol] = 0;
-        }
-        
-        // Check for castling
-        if (piece == 6 && fromRow == 0 && fromCol == 4) { // White king
-            if (toCol == 6) {
-                // Kingside castling
-                board[0][5] = 4;  // Move rook
-                board[0][7] = 0;
-            } else if (toCol == 2) {
-                // Queenside castling
-                board[0][3] = 4;  // Move rook
-                board[0][0] = 0;
-            }
-            whiteKingMoved = true;
-        } else if (piece == 12 && fromRow == 7 && fromCol == 4) { // Black king
-            if (toCol == 6) {
-                // Kingside castling
-                board[7][5] = 10;  // Move rook
-                board[7][7] = 0;
-            } else if (toCol == 2) {
-                // Queenside castling
-                board[7][3] = 10;  // Move rook
-                board[7][0] = 0;
-            }
-            blackKingMoved = true;
-        }
+    std::cout << std::endl;
+    std::cout << "Final error: " << std::setprecision(8) << meanError(k, false) << std::endl;
+    std::cout << "Weights written to " << output << std::endl;
+    std::cout << "Time (ms): " << elapsedMs() << std::endl;
+    return true;
+}
+
+// One UCI conversation with one engine. Commands go in a line at a time, and
+// every line the session writes goes to its output function. That includes
+// the "info" and "bestmove" lines written from the search thread. Searches
+// run on their own thread so "stop", "ponderhit" and "isready" are answered
+// while they run; any command that changes the position or the options
+// stops the running search first.
+//
+// The standalone engine runs a single session on standard input and output
+// (see uci()). A server session (see runServer) is one of many in the
+// process. It shares the network, book and tablebases with the others, and
+// the hash table unless it was given its own, so it cannot change them.
+class UCISession {
+public:
+    using Output = std::function<void(const std::string&)>;
+    
+    UCISession(Output output, TranspositionTable& table, bool server)
+        : output(std::move(output)), table(table), server(server) {
+        engine.setTranspositionTable(table);
+    }
+    
+    ~UCISession() {
+        stopSearch();
+    }
+    
+    UCISession(const UCISession&) = delete;
+    UCISession& operator=(const UCISession&) = delete;
+    
+    // Handles one command line. Returns false once the command was "quit".
+    bool command(const std::string& line) {
+        std::istringstream iss(line);
+        std::string token;
+        iss >> token;
         
-        // Update castling rights for rooks
-        if (piece == 4) {
-            if (fromRow == 0 && fromCol == 0) whiteQueensideRookMoved = true;
-            if (fromRow == 0 && fromCol == 7) whiteKingsideRookMoved = true;
-        } else if (piece == 10) {
-            if (fromRow == 7 && fromCol == 0) blackQueensideRookMoved = true;
-            if (fromRow == 7 && fromCol == 7) blackKingsideRookMoved = true;
+        if (token == "stop") {
+            stopSearch();
+            return true;
+        } else if (token == "ponderhit") {
+            // The expected move was played: keep searching, now on our own clock
+            control.pondering = false;
+            return true;
+        } else if (token == "isready") {
+            output("readyok");
+            return true;
+        } else if (token != "uci") {
+            stopSearch();
         }
         
-        // Update king moved flag
-        if (piece == 6) whiteKingMoved = true;
-        if (piece == 12) blackKingMoved = true;
-        
-        // Move the piece
-        board[toRow][toCol] = board[fromRow][fromCol];
-        board[fromRow][fromCol] = 0;
-        
-        // Check for pawn promotion (autoqueen for simplicity)
-        if (piece == 1 && toRow == 7) {
-            board[toRow][toCol] = 5;  // White queen
-        } else if (piece == 7 && toRow == 0) {
-            board[toRow][toCol] = 11;  // Black queen
+        if (token == "uci") {
+            output("id name RandomChess");
+            output("id author RandomChess Author");
+            output("option name Hash type spin default " + std::to_string(DEFAULT_HASH_MB)
+                   + " min 1 max " + std::to_string(MAX_HASH_MB));
+            output("option name Threads type spin default 1 min 1 max " + std::to_string(MAX_THREADS));
+            output("option name EvalFile type string default <empty>");
+            output("option name UseNNUE type check default true");
+            output("option name Ponder type check default false");
+            output("option name BookFile type string default <empty>");
+            output("option name SyzygyPath type string default <empty>");
+            output("option name NullMovePruning type check default true");
+            output("option name LateMoveReductions type check default true");
+            output("option name ReverseFutilityPruning type check default true");
+            output("option name FutilityPruning type check default true");
+            output("option name CheckExtensions type check default true");
+            output("uciok");
+        } else if (token == "ucinewgame") {
+            newEngine();  // Starts with an empty evaluation cache
+            positionBase.clear();
+            positionMoves.clear();
+            if (!sharesTable()) {
+                table.clear();
+            }
+        } else if (token == "setoption") {
+            // setoption name <id> value <x>
+            std::string name, value;
+            iss >> token;  // "name"
+            while (iss >> token && token != "value") {
+                name += (name.empty() ? "" : " ") + token;
+            }
+            std::getline(iss >> std::ws, value);  // File names may contain spaces
+            setOption(name, value);
+        } else if (token == "position") {
+            // position startpos|fen <fen> [moves <move> ...]
+            std::string base;
+            std::vector<std::string> moves;
+            while (iss >> token && token != "moves") {
+                base += token + " ";
+            }
+            while (iss >> token) {
+                moves.push_back(token);
+            }
+            
+            // During a game each command repeats the previous one plus the
+            // latest moves, and only those need to be played
+            bool extendsLast = base == positionBase && moves.size() >= positionMoves.size()
+                            && std::equal(positionMoves.begin(), positionMoves.end(), moves.begin());
+            if (!extendsLast) {
+                if (base.compare(0, 9, "startpos ") == 0) {
+                    newEngine();
+                } else if (base.compare(0, 4, "fen ") == 0) {
+                    engine.setPosition(base.substr(4));
+                } else {
+                    return true;
+                }
+                positionMoves.clear();
+            }
+            
+            for (size_t i = positionMoves.size(); i < moves.size(); i++) {
+                engine.makeMove(moves[i]);
+            }
+            positionBase = base;
+            positionMoves = moves;
+        } else if (token == "go") {
+            go(iss);
+        } else if (token == "bench") {
+            // bench [depth] [threads]
+            if (server) {
+                output("info string bench is not available in server mode");
+                return true;
+            }
+            int depth = DEFAULT_SEARCH_DEPTH;
+            int benchThreads = threads;
+            iss >> depth >> benchThreads;
+            runBench(depth, std::max(1, benchThreads));
+        } else if (token == "quit") {
+            return false;
         }
-        
-        // Switch player
-        whiteToMove = !whiteToMove;
+        return true;
     }
     
-    // Converts board coordinates (row, col) into algebraic notation (e.g. a1, e4)
-    std::string coordToAlgebraic(int row, int col) {
-        std::string result;
-        result += static_cast<char>('a' + col);
-        result += static_cast<char>('1' + row);
-        return result;
+private:
+    Output output;
+    TranspositionTable& table;
+    bool server;
+    
+    ChessEngine engine;
+    int threads = 1;
+    
+    SearchControl control;
+    std::thread searchThread;
+    
+    // Start position and moves of the last "position" command, which the
+    // engine's current position was set up from
+    std::string positionBase;
+    std::vector<std::string> positionMoves;
+    
+    // A server session's table may be in use by other sessions' searches
+    bool sharesTable() const {
+        return server && &table == &transpositionTable;
     }
     
-public:
-    ChessEngine() {
-        initializeBoard();
+    void stopSearch() {
+        control.stop = true;
+        if (searchThread.joinable()) {
+            searchThread.join();
+        }
     }
     
-    // Set up position using a very basic FEN parser (only piece placement and side-to-move)
-    void setPosition(const std::string& fen) {
-        // Reinitialize board first
-        initializeBoard();
-        
-        std::vector<std::string> fenParts;
-        std::istringstream iss(fen);
-        std::string part;
-        
-        while (std::getline(iss, part, ' ')) {
-            fenParts.push_back(part);
+    void newEngine() {
+        engine = ChessEngine();
+        engine.setTranspositionTable(table);
+    }
+    
+    void setOption(const std::string& name, const std::string& value) {
+        if (name == "Threads") {
+            threads = std::max(1, std::min(std::atoi(value.c_str()), MAX_THREADS));
+            return;
+        }
+        if (name == "Hash" && !sharesTable()) {
+            int megabytes = std::atoi(value.c_str());
+            table.resize(std::max(1, std::min(megabytes, MAX_HASH_MB)));
+            return;
         }
         
-        if (fenParts.empty()) return;
-        
-        // Parse board position
-        int row = 7;
-        int col = 0;
+        // Everything else is used by every session in the process
+        if (server) {
+            output("info string " + name + " is shared by all sessions and set when the server starts");
+            return;
+        }
         
-        for (char c : fenParts[0]) {
-            if (c == '/') {
-                row--;
-                col = 0;
-            } else if (c >= '1' && c <= '8') {
-                col += (c - '0');
+        if (name == "EvalFile") {
+            if (value.empty() || value == "<empty>") {
+                return;
+            }
+            if (nnueNetwork.load(value)) {
+                engine.clearEvalCache();
+                output("info string NNUE network " + value + " loaded");
             } else {
-                int piece = 0;
-                switch (c) {
-                    case 'P': piece = 1; break;  // White pawn
-                    case 'N': piece = 2; break;  // White knight
-                    case 'B': piece = 3; break;  // White bishop
-                    case 'R': piece = 4; break;  // White rook
-                    case 'Q': piece = 5; break;  // White queen
-                    case 'K': piece = 6; break;  // White king
-                    case 'p': piece = 7; break;  // Black pawn
-                    case 'n': piece = 8; break;  // Black knight
-                    case 'b': piece = 9; break;  // Black bishop
-                    case 'r': piece = 10; break; // Black rook
-                    case 'q': piece = 11; break; // Black queen
-                    case 'k': piece = 12; break; // Black king
-                }
-                
-                if (piece != 0 && row >= 0 && row < 8 && col >= 0 && col < 8) {
-                    board[row][col] = piece;
-                }
-                col++;
+                output("info string Failed to load NNUE network " + value);
             }
+        } else if (name == "UseNNUE") {
+            nnueNetwork.setEnabled(value == "true");
+            engine.clearEvalCache();
+        } else if (name == "BookFile") {
+            if (value.empty() || value == "<empty>") {
+                openingBook.unload();
+            } else if (openingBook.load(value)) {
+                output("info string Opening book " + value + " loaded");
+            } else {
+                output("info string Failed to load opening book " + value);
+            }
+        } else if (name == "SyzygyPath") {
+            int found = tablebases.init(value);
+            output("info string Found " + std::to_string(found) + " tablebases");
+        } else if (name == "NullMovePruning") {
+            searchOptions.nullMovePruning = (value == "true");
+        } else if (name == "LateMoveReductions") {
+            searchOptions.lateMoveReductions = (value == "true");
+        } else if (name == "ReverseFutilityPruning") {
+            searchOptions.reverseFutilityPruning = (value == "true");
+        } else if (name == "FutilityPruning") {
+            searchOptions.futilityPruning = (value == "true");
+        } else if (name == "CheckExtensions") {
+            searchOptions.checkExtensions = (value == "true");
         }
-        
-        // Parse side to move
-        if (fenParts.size() > 1) {
-            whiteToMove = (fenParts[1] == "w");
-        }
-        
-        // Castling rights and en passant fields are ignored for simplicity.
     }
     
-    // Instead of choosing a random move, we now perform a search.
-    // This function uses a basic negamax search with a fixed depth.
-    std::string getBestMove() {
-        const int SEARCH_DEPTH = 3;  // You can adjust the search depth here.
-        std::vector<std::pair<std::pair<int, int>, std::pair<int, int>>> legalMoves;
-        getAllLegalMoves(legalMoves);
+    // go [perft <depth>] [wtime ...] [infinite] [ponder] ...
+    void go(std::istringstream& iss) {
+        SearchLimits limits;
+        bool perft = false;
+        std::string token;
         
-        if (legalMoves.empty()) {
-            return "0000";  // No legal moves
+        while (iss >> token) {
+            if (token == "perft") {
+                perft = true;
+                iss >> limits.depth;
+            } else if (token == "wtime") {
+                iss >> limits.time[0];
+            } else if (token == "btime") {
+                iss >> limits.time[1];
+            } else if (token == "winc") {
+                iss >> limits.inc[0];
+            } else if (token == "binc") {
+                iss >> limits.inc[1];
+            } else if (token == "movestogo") {
+                iss >> limits.movesToGo;
+            } else if (token == "movetime") {
+                iss >> limits.moveTime;
+            } else if (token == "depth") {
+                iss >> limits.depth;
+            } else if (token == "nodes") {
+                iss >> limits.nodes;
+            } else if (token == "infinite") {
+                limits.infinite = true;
+            } else if (token == "ponder") {
+                limits.ponder = true;
+            }
         }
         
-        int bestScore = -1000000;
-        std::pair<std::pair<int, int>, std::pair<int, int>> bestMove = legalMoves[0];
+        // "go perft <depth>" runs the move generator test instead of a search.
+        // It prints to standard output, which a server session does not own.
+        if (perft) {
+            if (server) {
+                output("info string go perft is not available in server mode");
+            } else {
+                runPerft(engine, std::max(limits.depth, 1));
+            }
+            return;
+        }
         
-        for (const auto& move : legalMoves) {
-            ChessEngine child = *this;  // Copy current position
-            child.applyMove(move);
-            int score = -child.negamax(SEARCH_DEPTH - 1);
-            if (score > bestScore) {
-                bestScore = score;
-                bestMove = move;
+        // A book move is played without searching, except when "bestmove"
+        // has to wait for "stop" (infinite search and pondering)
+        if (openingBook.loaded() && !limits.infinite && !limits.ponder) {
+            std::string bookMove = engine.getBookMove(openingBook);
+            if (!bookMove.empty()) {
+                output("bestmove " + bookMove);
+                return;
             }
         }
         
-        std::string fromSquare = coordToAlgebraic(bestMove.first.first, bestMove.first.second);
-        std::string toSquare = coordToAlgebraic(bestMove.second.first, bestMove.second.second);
+        control.stop = false;
+        control.pondering = limits.ponder;
+        control.nodes = 0;
+        control.report = output;
         
-        return fromSquare + toSquare;
+        int searchThreads = threads;
+        searchThread = std::thread([this, limits, searchThreads] {
+            std::string bestMove = engine.getBestMove(limits, searchThreads, &control);
+            std::string ponderMove = engine.getPonderMove();
+            output("bestmove " + bestMove + (ponderMove.empty() ? "" : " ponder " + ponderMove));
+        });
+    }
+};
+
+// Runs the standalone engine: one UCI session on standard input and output
+void uci() {
+    UCISession session(sendLine, transpositionTable, false);
+    std::string line;
+    while (std::getline(std::cin, line) && session.command(line)) {
     }
+}
+
+// A server session, with the hash table it was given if it has its own
+struct ServerSession {
+    std::unique_ptr<TranspositionTable> table;
+    std::unique_ptr<UCISession> session;
+};
+
+// Hosts any number of independent UCI sessions in one process. The sessions
+// share the attack tables, the evaluation weights and network, the book and
+// the tablebases. They also share the global hash table, unless sessionHash
+// gives each session its own table of that many megabytes.
+//
+// Without a socket path the sessions are multiplexed over standard input and
+// output: each input line is "<session> <command>", a session is opened by
+// its first command and closed by "quit", and every output line starts with
+// its session's name. With a socket path the server listens on a Unix socket
+// there, and each connection is a session speaking plain UCI. Returns false
+// if the socket cannot be set up.
+bool runServer(const std::string& socketPath, int sessionHash) {
+    auto openSession = [sessionHash](UCISession::Output output) {
+        ServerSession opened;
+        TranspositionTable* table = &transpositionTable;
+        if (sessionHash > 0) {
+            opened.table.reset(new TranspositionTable());
+            opened.table->resize(sessionHash);
+            table = opened.table.get();
+        }
+        opened.session.reset(new UCISession(std::move(output), *table, true));
+        return opened;
+    };
     
-    // Make a move using a string in algebraic coordinate notation, e.g. "e2e4"
-    void makeMove(const std::string& moveStr) {
-        if (moveStr.length() < 4) return;
-        
-        int fromCol = moveStr[0] - 'a';
-        int fromRow = moveStr[1] - '1';
-        int toCol = moveStr[2] - 'a';
-        int toRow = moveStr[3] - '1';
-        
-        makeMove({{fromRow, fromCol}, {toRow, toCol}});
+    if (socketPath.empty()) {
+        std::map<std::string, ServerSession> sessions;
+        std::string line;
+        while (std::getline(std::cin, line)) {
+            std::istringstream iss(line);
+            std::string name, command;
+            if (!(iss >> name)) {
+                continue;
+            }
+            std::getline(iss >> std::ws, command);
+            
+            auto session = sessions.find(name);
+            if (session == sessions.end()) {
+                session = sessions.emplace(name, openSession([name](const std::string& output) {
+                    sendLine(name + " " + output);
+                })).first;
+            }
+            if (!session->second.session->command(command)) {
+                sessions.erase(session);
+            }
+        }
+        return true;
     }
+
+#if defined(_WIN32)
+    std::cout << "Unix sockets are not supported on Windows" << std::endl;
+    return false;
+#else
+    // A client that disconnects mid-search must not take the server down
+    std::signal(SIGPIPE, SIG_IGN);
     
-    // -------------------------
-    // New public helper methods for search
-    // -------------------------
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0 || socketPath.size() >= sizeof(address.sun_path)) {
+        std::cout << "Cannot create socket " << socketPath << std::endl;
+        return false;
+    }
+    std::strcpy(address.sun_path, socketPath.c_str());
+    unlink(socketPath.c_str());  // Left over from an earlier run
+    if (bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0
+        || listen(listener, SOMAXCONN) < 0) {
+        std::cout << "Cannot listen on " << socketPath << std::endl;
+        close(listener);
+        return false;
+    }
+    std::cout << "Listening on " << socketPath << std::endl;
     
-    // Returns all legal moves as a vector of moves (each move is given as a pair-of-pairs)
-    std::vector<std::pair<std::pair<int, int>, std::pair<int, int>>> getLegalMoves() {
-        std::vector<std::pair<std::pair<int, int>, std::pair<int, int>>> moves;
-        getAllLegalMoves(moves);
-        return moves;
+    for (;;) {
+        int client = accept(listener, nullptr, nullptr);
+        if (client < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        
+        std::thread([client, openSession] {
+            std::mutex writeMutex;
+            ServerSession session = openSession([client, &writeMutex](const std::string& output) {
+                std::lock_guard<std::mutex> lock(writeMutex);
+                std::string data = output + "\n";
+                for (size_t sent = 0; sent < data.size();) {
+                    ssize_t written = write(client, data.data() + sent, data.size() - sent);
+                    if (written <= 0) {
+                        break;  // The client is gone
+                    }
+                    sent += size_t(written);
+                }
+            });
+            
+            std::string pending;
+            char buffer[4096];
+            bool open = true;
+            ssize_t received;
+            while (open && (received = read(client, buffer, sizeof(buffer))) > 0) {
+                pending.append(buffer, size_t(received));
+                size_t end;
+                while (open && (end = pending.find('\n')) != std::string::npos) {
+                    std::string line = pending.substr(0, end);
+                    pending.erase(0, end + 1);
+                    if (!line.empty() && line.back() == '\r') {
+                        line.pop_back();
+                    }
+                    open = session.session->command(line);
+                }
+            }
+            
+            // Ends the search, which writes to the socket, before closing it
+            session.session.reset();
+            close(client);
+        }).detach();
     }
     
-    // Applies a move (given as a pair-of-pairs) to the board.
-    void applyMove(const std::pair<std::pair<int, int>, std::pair<int, int>>& move) {
-        makeMove(move);
+    close(listener);
+    return false;
+#endif
+}
+
+// Built with -DNEXA_LIBRARY the file has no main(), so another program can
+// include it and use ChessEngine, or UCISession over a transport of its own
+#if !defined(NEXA_LIBRARY)
+int main(int argc, char* argv[]) {
+    // "nexa bench [depth] [threads]" runs the benchmark and exits, for use in build scripts
+    if (argc > 1 && std::string(argv[1]) == "bench") {
+        runBench(argc > 2 ? std::atoi(argv[2]) : DEFAULT_SEARCH_DEPTH,
+                 argc > 3 ? std::max(1, std::atoi(argv[3])) : 1);
+        return 0;
     }
     
-    // Basic evaluation function (material only)
-    int evaluateBoard() const {
-        int score = 0;
-        for (int row = 0; row < 8; row++) {
-            for (int col = 0; col < 8; col++) {
-                int piece = board[row][col];
-                switch (piece) {
-                    case 1: score += 100; break;   // White Pawn
-                    case 2: score += 320; break;   // White Knight
-                    case 3: score += 330; break;   // White Bishop
-                    case 4: score += 500; break;   // White Rook
-                    case 5: score += 900; break;   // White Queen
-                    case 6: score += 20000; break; // White King
-                    case 7: score -= 100; break;   // Black Pawn
-                    case 8: score -= 320; break;   // Black Knight
-                    case 9: score -= 330; break;   // Black Bishop
-                    case 10: score -= 500; break;  // Black Rook
-                    case 11: score -= 900; break;  // Black Queen
-                    case 12: score -= 20000; break; // Black King
-                }
+    // "nexa --epd <file> [--threads N] [--depth D] [--movetime MS] [--hash MB]"
+    // runs a test suite with N positions analyzed at a time and exits
+    if (argc > 2 && std::string(argv[1]) == "--epd") {
+        SearchLimits limits;
+        int workers = 1;
+        for (int i = 3; i + 1 < argc; i += 2) {
+            std::string option = argv[i];
+            int value = std::atoi(argv[i + 1]);
+            if (option == "--threads") {
+                workers = std::max(1, std::min(value, MAX_THREADS));
+            } else if (option == "--depth") {
+                limits.depth = value;
+            } else if (option == "--movetime") {
+                limits.moveTime = value;
+            } else if (option == "--hash") {
+                transpositionTable.resize(std::max(1, std::min(value, MAX_HASH_MB)));
             }
         }
-        return score;
+        return runEPD(argv[2], workers, limits) ? 0 : 1;
     }
     
-    // Negamax search (without alpha-beta pruning). Returns a score from the point-of-view 
-    // of the side to move.
-    int negamax(int depth) {
-        if (depth == 0) {
-            // Evaluate from white's perspective; if it is blacks turn, negate the value.
-            int eval = evaluateBoard();
-            return whiteToMove ? eval : -eval;
-        }
-        
-        std::vector<std::pair<std::pair<int, int>, std::pair<int, int>>> moves = getLegalMoves();
-        if (moves.empty()) {
-            // No legal moves (checkmate/stalemate): return a very bad score.
-            return -100000;
+    // "nexa --selfplay <file> [--games N] [--threads N] [--nodes N]
+    // [--random-plies N] [--seed N]" generates training data and exits
+    if (argc > 2 && std::string(argv[1]) == "--selfplay") {
+        int games = 1000;
+        int workers = 1;
+        uint64_t nodes = 1000;
+        int randomPlies = 8;
+        uint32_t seed = uint32_t(std::chrono::system_clock::now().time_since_epoch().count());
+        for (int i = 3; i + 1 < argc; i += 2) {
+            std::string option = argv[i];
+            long long value = std::atoll(argv[i + 1]);
+            if (option == "--games") {
+                games = int(value);
+            } else if (option == "--threads") {
+                workers = std::max(1, std::min(int(value), MAX_THREADS));
+            } else if (option == "--nodes") {
+                nodes = uint64_t(std::max(1LL, value));
+            } else if (option == "--random-plies") {
+                randomPlies = std::max(0, int(value));
+            } else if (option == "--seed") {
+                seed = uint32_t(value);
+            } else if (option == "--hash") {
+                transpositionTable.resize(std::max(1, std::min(int(value), MAX_HASH_MB)));
+            }
         }
-        
-        int bestScore = -1000000;
-        for (const auto& move : moves) {
-            ChessEngine child = *this;
-            child.applyMove(move);
-            int score = -child.negamax(depth - 1);
-            if (score > bestScore) {
-                bestScore = score;
+        return runSelfplay(argv[2], games, workers, nodes, randomPlies, seed) ? 0 : 1;
+    }
+    
+    // "nexa --tune <file> [--threads N] [--epochs N] [--rate R] [--output F]"
+    // tunes the evaluation weights on training data and exits
+    if (argc > 2 && std::string(argv[1]) == "--tune") {
+        int workers = 1;
+        int epochs = 1000;
+        double rate = 1.0;
+        std::string output = "weights.h";
+        for (int i = 3; i + 1 < argc; i += 2) {
+            std::string option = argv[i];
+            if (option == "--threads") {
+                workers = std::max(1, std::min(std::atoi(argv[i + 1]), MAX_THREADS));
+            } else if (option == "--epochs") {
+                epochs = std::max(1, std::atoi(argv[i + 1]));
+            } else if (option == "--rate") {
+                rate = std::atof(argv[i + 1]);
+            } else if (option == "--output") {
+                output = argv[i + 1];
             }
         }
-        return bestScore;
+        return runTune(argv[2], output, workers, epochs, rate) ? 0 : 1;
     }
-};
-
-// This function implements the UCI communication loop.
-void uci() {
-    ChessEngine engine;
-    std::string line;
     
-    while (std::getline(std::cin, line)) {
-        std::istringstream iss(line);
-        std::string token;
-        iss >> token;
-        
-        if (token == "uci") {
-            std::cout << "id name RandomChess" << std::endl;
-            std::cout << "id author RandomChess Author" << std::endl;
-            std::cout << "uciok" << std::endl;
-        } else if (token == "isready") {
-            std::cout << "readyok" << std::endl;
-        } else if (token == "ucinewgame") {
-            engine = ChessEngine();
-        } else if (token == "position") {
-            iss >> token;
-            
-            if (token == "startpos") {
-                engine = ChessEngine();
-                
-                iss >> token;  // This should be "moves" or end-of-line.
-                if (token == "moves") {
-                    std::string move;
-                    while (iss >> move) {
-                        engine.makeMove(move);
-                    }
-                }
-            } else if (token == "fen") {
-                std::string fen;
-                
-                // Read the rest of the FEN string (which may include spaces)
-                std::string fenPart;
-                while (iss >> fenPart) {
-                    if (fenPart == "moves") break;
-                    fen += fenPart + " ";
-                }
-                
-                engine.setPosition(fen);
-                
-                if (fenPart == "moves") {
-                    std::string move;
-                    while (iss >> move) {
-                        engine.makeMove(move);
-                    }
-                }
+    // "nexa --server [--socket <path>] [--hash MB] [--session-hash MB]
+    // [--eval <file>] [--book <file>] [--syzygy <path>]" hosts many game
+    // sessions, multiplexed over standard input or on a Unix socket
+    if (argc > 1 && std::string(argv[1]) == "--server") {
+        std::string socketPath;
+        int sessionHash = 0;
+        for (int i = 2; i + 1 < argc; i += 2) {
+            std::string option = argv[i];
+            std::string value = argv[i + 1];
+            if (option == "--socket") {
+                socketPath = value;
+            } else if (option == "--hash") {
+                transpositionTable.resize(std::max(1, std::min(std::atoi(value.c_str()), MAX_HASH_MB)));
+            } else if (option == "--session-hash") {
+                sessionHash = std::max(0, std::min(std::atoi(value.c_str()), MAX_HASH_MB));
+            } else if (option == "--eval" && !nnueNetwork.load(value)) {
+                std::cout << "Failed to load NNUE network " << value << std::endl;
+                return 1;
+            } else if (option == "--book" && !openingBook.load(value)) {
+                std::cout << "Failed to load opening book " << value << std::endl;
+                return 1;
+            } else if (option == "--syzygy") {
+                tablebases.init(value);
             }
-        } else if (token == "go") {
-            // For simplicity we ignore extra 'go' parameters.
-            std::string bestMove = engine.getBestMove();
-            std::cout << "bestmove " << bestMove << std::endl;
-        } else if (token == "quit") {
-            break;
         }
+        return runServer(socketPath, sessionHash) ? 0 : 1;
     }
-}
-
-int main() {
+    
     uci();
     return 0;
-}
\ No newline at end of file
+}
+#endif
\ No newline at end of file